@@ -0,0 +1,287 @@
+// Micro-benchmarks of the storage layers over synthetic in-memory images.
+// Prints one JSON document to stdout; see Usage() for options.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "aes_ctr.h"
+#include "block_cache.h"
+#include "crypto.h"
+#include "dpfs_level.h"
+#include "fat.h"
+#include "fs_interface.h"
+#include "ivfc_level.h"
+#include "memory_file.h"
+#include "metadata_table.h"
+#include "thread_pool.h"
+
+struct Result {
+    std::string name;
+    u64 iterations;
+    double ns_per_op;
+    std::size_t bytes_per_op;
+};
+
+static std::vector<Result> results;
+static const char* filter = nullptr;
+static double min_seconds = 0.5;
+static std::mt19937_64 rng(0x3d5);
+
+static bytes RandomBytes(std::size_t size) {
+    bytes result(size);
+    for (auto& b : result)
+        b = (u8)rng();
+    return result;
+}
+
+static std::size_t RandomIndex(std::size_t count) {
+    return rng() % count;
+}
+
+// Runs `op` in rounds of doubling size until a round takes at least min_seconds.
+static void Run(const std::string& name, std::size_t bytes_per_op,
+                const std::function<void()>& op) {
+    if (filter && name.find(filter) == std::string::npos)
+        return;
+
+    u64 iterations = 1;
+    while (true) {
+        auto start = std::chrono::steady_clock::now();
+        for (u64 i = 0; i < iterations; ++i)
+            op();
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() -
+                                                             start)
+                        .count();
+        if (ns >= min_seconds * 1e9 || iterations >= (1ull << 40)) {
+            results.push_back({name, iterations, ns / iterations, bytes_per_op});
+            std::fprintf(stderr, "%-40s %14.1f ns/op\n", name.c_str(), ns / iterations);
+            return;
+        }
+        iterations *= 2;
+    }
+}
+
+static void BenchSha256() {
+    auto data = RandomBytes(0x1000 * 64);
+    u8 digest[0x20 * 64];
+    Crypto::Sha256Backend original = Crypto::GetSha256Backend();
+    for (auto backend : {Crypto::Sha256Backend::Scalar, Crypto::Sha256Backend::ShaNi,
+                         Crypto::Sha256Backend::Avx2}) {
+        if (!Crypto::SetSha256Backend(backend))
+            continue;
+        std::string prefix = std::string("sha256/") + Crypto::GetSha256BackendName(backend);
+        Run(prefix + "/single_4k", 0x1000, [&] { Crypto::Sha256(data.data(), 0x1000, digest); });
+        Run(prefix + "/blocks_64x4k", data.size(),
+            [&] { Crypto::Sha256Blocks(data.data(), 0x1000, 64, digest); });
+    }
+    Crypto::SetSha256Backend(original);
+}
+
+static void BenchAesCtr() {
+    constexpr std::size_t size = 0x100000;
+    AesCtrFile file(std::make_shared<MemoryFile>(RandomBytes(size)), RandomBytes(16),
+                    RandomBytes(16));
+    for (std::size_t read_size : {0x10, 0x200, 0x1000, 0x10000}) {
+        Run("aes_ctr/read_" + std::to_string(read_size), read_size,
+            [&] { file.Read(RandomIndex(size - read_size), read_size); });
+    }
+    Run("aes_ctr/write_4k", 0x1000,
+        [&, data = RandomBytes(0x1000)] { file.Write(RandomIndex(size - 0x1000), data); });
+}
+
+static void BenchIvfc() {
+    constexpr std::size_t block_size = 0x1000;
+    constexpr std::size_t size = 0x400000;
+    auto body = std::make_shared<MemoryFile>(RandomBytes(size));
+    auto hash = std::make_shared<MemoryFile>(bytes(size / block_size * 0x20));
+    IvfcLevel level(hash, body, block_size);
+    level.Rehash();
+
+    std::size_t block_count = size / block_size;
+    for (std::size_t blocks : {1, 16}) {
+        std::string suffix = std::to_string(blocks * block_size);
+        Run("ivfc/read_" + suffix, blocks * block_size, [&] {
+            level.Read(RandomIndex(block_count - blocks + 1) * block_size, blocks * block_size);
+        });
+        Run("ivfc/write_" + suffix, blocks * block_size,
+            [&, data = RandomBytes(blocks * block_size)] {
+                level.Write(RandomIndex(block_count - blocks + 1) * block_size, data);
+            });
+    }
+    Run("ivfc/read_unaligned_100", 100, [&] { level.Read(RandomIndex(size - 100), 100); });
+    Run("ivfc/rehash_4m", size, [&] { level.Rehash(); });
+}
+
+static void BenchCache() {
+    constexpr std::size_t block_size = 0x1000;
+    constexpr std::size_t size = 0x400000;
+    auto body = std::make_shared<MemoryFile>(RandomBytes(size));
+    auto hash = std::make_shared<MemoryFile>(bytes(size / block_size * 0x20));
+    auto level = std::make_shared<IvfcLevel>(hash, body, block_size);
+    level->Rehash();
+
+    // With all of the level resident, and with a quarter of it, so that most reads miss and evict.
+    std::size_t block_count = size / block_size;
+    for (std::size_t budget : {size, size / 4}) {
+        BlockCache cache(level, block_size, std::make_shared<CacheBudget>(budget));
+        std::string suffix = budget == size ? "resident" : "quarter";
+        Run("cache/read_4096_" + suffix, block_size, [&] {
+            cache.Read(RandomIndex(block_count) * block_size, block_size);
+        });
+    }
+}
+
+static void BenchCow() {
+    constexpr std::size_t size = 0x400000;
+    CowFile file(std::make_shared<MemoryFile>(RandomBytes(size)));
+    Run("cow/write_4k", 0x1000,
+        [&, data = RandomBytes(0x1000)] { file.Write(RandomIndex(size - 0x1000), data); });
+    Run("cow/read_64k", 0x10000, [&] { file.Read(RandomIndex(size - 0x10000), 0x10000); });
+    Run("cow/commit", 0, [&] {
+        file.Write(RandomIndex(size - 0x1000), bytes(0x1000));
+        file.Commit();
+    });
+}
+
+static void BenchDpfs() {
+    constexpr std::size_t size = 0x400000;
+    for (std::size_t block_size : {0x80, 0x1000}) {
+        std::size_t block_count = size / block_size;
+        auto selector = std::make_shared<MemoryFile>(RandomBytes((block_count + 31) / 32 * 4));
+        auto pair = std::make_shared<MemoryFile>(RandomBytes(size * 2));
+        DpfsLevel level(selector, pair, block_size);
+        std::string prefix = "dpfs/block_" + std::to_string(block_size);
+        Run(prefix + "/read_block", block_size,
+            [&] { level.Read(RandomIndex(block_count) * block_size, block_size); });
+        Run(prefix + "/read_64k", 0x10000,
+            [&] { level.Read(RandomIndex(size - 0x10000), 0x10000); });
+    }
+}
+
+// An empty FAT of `block_count` blocks, all in one free node.
+static bytes MakeFatImage(u32 block_count) {
+    bytes image((block_count + 1) * 8, 0);
+    auto set = [&image](u32 entry, u32 u, u32 v) {
+        std::memcpy(image.data() + entry * 8, &u, 4);
+        std::memcpy(image.data() + entry * 8 + 4, &v, 4);
+    };
+    set(0, 0, 1);
+    set(1, 0x80000000, 0x80000000);
+    set(2, 0x80000000 + 1, block_count);
+    set(block_count, 0x80000000 + 1, block_count);
+    return image;
+}
+
+static void BenchFat() {
+    constexpr u32 block_count = 0x1000;
+    Fat fat(std::make_shared<MemoryFile>(MakeFatImage(block_count)));
+
+    Run("fat/allocate_free_1", 0, [&] { fat.FreeChain(fat.AllocateChain(1)[0].block_index); });
+    Run("fat/allocate_free_64", 0, [&] { fat.FreeChain(fat.AllocateChain(64)[0].block_index); });
+
+    // Free every other single-block chain, so that the next allocation collects 128 nodes.
+    std::vector<u32> singles;
+    for (int i = 0; i < 256; ++i)
+        singles.push_back(fat.AllocateChain(1)[0].block_index);
+    for (int i = 0; i < 256; i += 2)
+        fat.FreeChain(singles[i]);
+    u32 fragmented = fat.AllocateChain(128)[0].block_index;
+    u32 contiguous = fat.AllocateChain(128)[0].block_index;
+    Run("fat/get_chain_128_fragmented", 0, [&] { fat.GetChain(fragmented); });
+    Run("fat/get_chain_128_contiguous", 0, [&] { fat.GetChain(contiguous); });
+}
+
+static FsName MakeName(const std::string& str) {
+    FsName name{};
+    std::memcpy(name.data(), str.data(), std::min(str.size(), name.size()));
+    return name;
+}
+
+static void BenchMetadata() {
+    constexpr u32 dir_count = 64;
+    constexpr u32 files_per_dir = 16;
+    constexpr u32 buckets = 0x101;
+
+    // Entry 0 holds the allocation counters; directory 1 is the root.
+    bytes dir_entries((dir_count + 2) * 0x28, 0);
+    bytes file_entries((dir_count * files_per_dir + 1) * 0x30, 0);
+    u32 counts[] = {2, dir_count + 2, 1, dir_count * files_per_dir + 1};
+    std::memcpy(dir_entries.data(), &counts[0], 8);
+    std::memcpy(file_entries.data(), &counts[2], 8);
+    FsMetadata meta(std::make_shared<MemoryFile>(std::move(dir_entries)),
+                    std::make_shared<MemoryFile>(bytes(buckets * 4)),
+                    std::make_shared<MemoryFile>(std::move(file_entries)),
+                    std::make_shared<MemoryFile>(bytes(buckets * 4)));
+
+    std::vector<std::string> paths;
+    for (u32 d = 0; d < dir_count; ++d) {
+        std::string dir_name = "dir" + std::to_string(d);
+        u32 dir = meta.MakeDir(MakeName(dir_name), 1);
+        for (u32 f = 0; f < files_per_dir; ++f) {
+            std::string file_name = "file" + std::to_string(f) + ".bin";
+            meta.MakeFile(MakeName(file_name), dir);
+            paths.push_back("/" + dir_name + "/" + file_name);
+        }
+    }
+
+    Run("metadata/find_hit", 0, [&] { meta.Find(paths[RandomIndex(paths.size())].c_str()); });
+    Run("metadata/find_miss", 0, [&] { meta.Find("/dir1/missing.bin"); });
+    Run("metadata/list_root", 0, [&] { meta.ListSubDir(1); });
+}
+
+static void BenchFsPath() {
+    Run("fs_path/short", 0, [] { FsPath path("/save.bin"); });
+    Run("fs_path/deep", 0, [] { FsPath path("/a/b/../c/./d/e/f/g/h/very_long_file_name.bin"); });
+}
+
+static void Usage() {
+    std::fprintf(stderr, R"(Usage: 3dsfuse-bench [--filter SUBSTRING] [--min-time SECONDS]
+Runs the micro-benchmarks whose name contains SUBSTRING, each for at least SECONDS (default 0.5).
+Results are printed to stdout as JSON, progress to stderr.
+)");
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (std::strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            min_seconds = std::atof(argv[++i]);
+        } else {
+            Usage();
+            return 1;
+        }
+    }
+
+    BenchSha256();
+    BenchAesCtr();
+    BenchIvfc();
+    BenchCache();
+    BenchCow();
+    BenchDpfs();
+    BenchFat();
+    BenchMetadata();
+    BenchFsPath();
+
+    std::printf("{\n  \"sha256_backend\": \"%s\",\n  \"threads\": %u,\n  \"benchmarks\": [",
+                Crypto::GetSha256BackendName(Crypto::GetSha256Backend()),
+                ThreadPool::Default().GetThreadCount());
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const Result& result = results[i];
+        std::printf("%s\n    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.1f",
+                    i ? "," : "", result.name.c_str(), (unsigned long long)result.iterations,
+                    result.ns_per_op);
+        if (result.bytes_per_op)
+            std::printf(", \"bytes_per_second\": %.0f",
+                        result.bytes_per_op * 1e9 / result.ns_per_op);
+        std::printf("}");
+    }
+    std::printf("\n  ]\n}\n");
+}
@@ -38,11 +38,16 @@ bytes CtrSignAesCmacBlock::Block(const bytes& data) {
 
 AesCmacSigned::AesCmacSigned(std::shared_ptr<FileInterface> signature_,
                              std::shared_ptr<FileInterface> data_, const bytes& key_,
-                             std::unique_ptr<AesCmacBlockProvider> block_provider_)
+                             std::unique_ptr<AesCmacBlockProvider> block_provider_,
+                             bool verified_, bool defer_verify)
     : FileInterface(data_->file_size), signature(std::move(signature_)), data(std::move(data_)),
-      key(key_), block_provider(std::move(block_provider_)) {
-    auto hash = block_provider->Hash(this->data->Read(0, this->data->file_size));
-    assert(signature->Read(0, 16) == Crypto::AesCmac(hash, key));
+      key(key_), block_provider(std::move(block_provider_)), verified(verified_) {
+    if (!defer_verify)
+        Verify();
+}
+
+bool AesCmacSigned::IsVerified() const {
+    return verified;
 }
 
 bytes AesCmacSigned::ReadImpl(std::size_t offset, std::size_t size) {
@@ -50,7 +55,21 @@ bytes AesCmacSigned::ReadImpl(std::size_t offset, std::size_t size) {
 }
 
 void AesCmacSigned::WriteImpl(std::size_t offset, const bytes& data) {
+    Verify();
     this->data->Write(offset, data);
-    auto hash = block_provider->Hash(this->data->Read(0, this->data->file_size));
-    signature->Write(0, Crypto::AesCmac(hash, key));
+    signature->Write(0, Sign());
+    if (stats)
+        ++stats->signatures;
+}
+
+void AesCmacSigned::Verify() {
+    if (verified)
+        return;
+    assert(signature->Read(0, 16) == Sign());
+    verified = true;
+}
+
+bytes AesCmacSigned::Sign() {
+    auto hash = block_provider->Hash(data->Read(0, data->file_size));
+    return Crypto::AesCmac(hash, key);
 }
@@ -38,10 +38,15 @@ private:
     u64 id;
 };
 
-class AesCmacSigned : public FileInterface {
+class AesCmacSigned final : public FileInterface {
 public:
+    // The signature is checked on construction, or before the first write if `defer_verify`,
+    // unless `verified_` says it is already known good.
     AesCmacSigned(std::shared_ptr<FileInterface> signature_, std::shared_ptr<FileInterface> data_,
-                  const bytes& key, std::unique_ptr<AesCmacBlockProvider> block_provider_);
+                  const bytes& key, std::unique_ptr<AesCmacBlockProvider> block_provider_,
+                  bool verified_ = false, bool defer_verify = false);
+
+    bool IsVerified() const;
 
 protected:
     bytes ReadImpl(std::size_t offset, std::size_t size) override;
@@ -52,4 +57,8 @@ private:
     std::shared_ptr<FileInterface> data;
     bytes key;
     std::unique_ptr<AesCmacBlockProvider> block_provider;
+    bool verified;
+
+    void Verify();
+    bytes Sign();
 };
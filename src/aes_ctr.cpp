@@ -1,39 +1,67 @@
+#include <algorithm>
 #include <openssl/evp.h>
 #include "aes_ctr.h"
 
 AesCtrFile::AesCtrFile(std::shared_ptr<FileInterface> cipher_, const bytes& key_, const bytes& iv_)
-    : BlockFile(cipher_->file_size, 0x10), cipher(std::move(cipher_)), key(key_), iv(iv_) {}
+    : BlockFile(cipher_->file_size, 0x10), cipher(std::move(cipher_)), key(key_), iv(iv_),
+      ctx(EVP_CIPHER_CTX_new()) {}
 
-bytes AesCtrFile::ReadBlock(std::size_t block_index) {
-    std::size_t offset = block_index * block_size;
-    std::size_t upper = offset + block_size;
-    std::size_t end = std::min(upper, file_size);
-    auto result = cipher->Read(offset, end - offset);
-    result += bytes(upper - end, 0);
-
-    bytes xor_pad = SeekIv(block_index);
-
-    for (unsigned i = 0; i < 16; ++i) {
-        result[i] ^= xor_pad[i];
-    }
+AesCtrFile::~AesCtrFile() {
+    EVP_CIPHER_CTX_free(ctx);
+}
 
+bytes AesCtrFile::ReadBlock(std::size_t block_index) {
+    bytes result(block_size);
+    ReadBlocks(block_index, 1, result.data());
     return result;
 }
 
 void AesCtrFile::WriteBlock(std::size_t block_index, const bytes& data) {
-    std::size_t offset = block_index * block_size;
-    std::size_t upper = offset + block_size;
+    WriteBlocks(block_index, 1, data.data());
+}
+
+void AesCtrFile::ReadBlocks(std::size_t first, std::size_t count, u8* dst) {
+    std::size_t offset = first * block_size;
+    std::size_t upper = offset + count * block_size;
     std::size_t end = std::min(upper, file_size);
-    auto buffer = data;
-    buffer.resize(end - offset);
+    cipher->Read(offset, end - offset, dst);
+    std::fill(dst + (end - offset), dst + count * block_size, 0);
+    Crypt(first, count, dst);
+}
 
-    bytes xor_pad = SeekIv(block_index);
+void AesCtrFile::WriteBlocks(std::size_t first, std::size_t count, const u8* src) {
+    std::size_t offset = first * block_size;
+    std::size_t upper = offset + count * block_size;
+    std::size_t end = std::min(upper, file_size);
+    buffer.assign(src, src + count * block_size);
+    Crypt(first, count, buffer.data());
+    cipher->Write(offset, end - offset, buffer.data());
+}
 
-    for (unsigned i = 0; i < 16; ++i) {
-        buffer[i] ^= xor_pad[i];
-    }
+void AesCtrFile::Crypt(std::size_t first, std::size_t count, u8* data) {
+    constexpr std::size_t max_run = 0x100000; // keeps the length within an int
+    if (stats)
+        stats->cipher_blocks += count;
+
+    while (count != 0) {
+        // Only the low 64 bits of the counter are incremented, while OpenSSL carries into the high
+        // half, so a run that wraps the low half is split there.
+        bytes counter = SeekIv(first);
+        u64 low = 0;
+        for (unsigned i = 8; i < 16; ++i)
+            low = (low << 8) | counter[i];
+        u64 before_wrap = ~low + 1;
+        std::size_t run = std::min(count, max_run);
+        if (before_wrap != 0 && before_wrap < run)
+            run = (std::size_t)before_wrap;
 
-    cipher->Write(offset, buffer);
+        EVP_EncryptInit_ex(ctx, EVP_aes_128_ctr(), NULL, key.data(), counter.data());
+        int outlen;
+        EVP_EncryptUpdate(ctx, data, &outlen, data, (int)(run * block_size));
+        first += run;
+        count -= run;
+        data += run * block_size;
+    }
 }
 
 bytes AesCtrFile::SeekIv(std::size_t block_index) {
@@ -44,16 +72,5 @@ bytes AesCtrFile::SeekIv(std::size_t block_index) {
         result[i] = (byte)(remain & 0xFF);
         remain >>= 8;
     }
-
-    bytes result2(16);
-    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-    EVP_CIPHER_CTX_init(ctx);
-    EVP_EncryptInit_ex(ctx, EVP_aes_128_ecb(), NULL, key.data(), NULL);
-    EVP_CIPHER_CTX_set_padding(ctx, false);
-    int outlen;
-    EVP_EncryptUpdate(ctx, result2.data(), &outlen, result.data(), 16);
-    EVP_EncryptFinal_ex(ctx, result2.data() + outlen, &outlen);
-    EVP_CIPHER_CTX_free(ctx);
-
-    return result2;
+    return result;
 }
@@ -3,17 +3,27 @@
 #include <memory>
 #include "block_file.h"
 
-class AesCtrFile : public BlockFile {
+typedef struct evp_cipher_ctx_st EVP_CIPHER_CTX;
+
+class AesCtrFile final : public BlockFile {
 public:
     AesCtrFile(std::shared_ptr<FileInterface> cipher_, const bytes& key_, const bytes& iv_);
+    ~AesCtrFile();
 
 protected:
     bytes ReadBlock(std::size_t block_index) override;
     void WriteBlock(std::size_t block_index, const bytes& data) override;
+    void ReadBlocks(std::size_t first, std::size_t count, u8* dst) override;
+    void WriteBlocks(std::size_t first, std::size_t count, const u8* src) override;
 
 private:
+    // XORs the keystream for blocks [first, first + count) into `data`.
+    void Crypt(std::size_t first, std::size_t count, u8* data);
     bytes SeekIv(std::size_t block_index);
     std::shared_ptr<FileInterface> cipher;
     bytes key;
     bytes iv;
+    EVP_CIPHER_CTX* ctx;
+    // Ciphertext of the current write. Kept to reuse its allocation.
+    bytes buffer;
 };
@@ -3,14 +3,23 @@
 #include <cstddef>
 #include <type_traits>
 
+constexpr bool IsPowerOfTwo(std::size_t size) {
+    return size != 0 && (size & (size - 1)) == 0;
+}
+
+// Power-of-two sizes, which cover every block size in the format, are aligned with a mask.
 template <typename T>
 constexpr T AlignUp(T value, std::size_t size) {
     static_assert(std::is_unsigned<T>::value, "T must be an unsigned value.");
+    if (IsPowerOfTwo(size))
+        return static_cast<T>((value + (size - 1)) & ~static_cast<T>(size - 1));
     return static_cast<T>(value + (size - value % size) % size);
 }
 
 template <typename T>
 constexpr T AlignDown(T value, std::size_t size) {
     static_assert(std::is_unsigned<T>::value, "T must be an unsigned value.");
+    if (IsPowerOfTwo(size))
+        return static_cast<T>(value & ~static_cast<T>(size - 1));
     return static_cast<T>(value - value % size);
 }
@@ -0,0 +1,43 @@
+#include <cstdlib>
+#include <new>
+#include "alloc_count.h"
+
+// The global allocation functions are replaced to count calls per thread; memory still comes from
+// malloc.
+static thread_local u64 allocation_count = 0;
+
+u64 GetThreadAllocationCount() {
+    return allocation_count;
+}
+
+static void* CountedAllocate(std::size_t size) {
+    ++allocation_count;
+    void* result = std::malloc(size ? size : 1);
+    if (!result)
+        throw std::bad_alloc();
+    return result;
+}
+
+void* operator new(std::size_t size) {
+    return CountedAllocate(size);
+}
+
+void* operator new[](std::size_t size) {
+    return CountedAllocate(size);
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "common_types.h"
+
+// Number of heap allocations made through operator new on the calling thread so far.
+u64 GetThreadAllocationCount();
@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <cstring>
+#include "block_cache.h"
+
+CacheBudget::CacheBudget(std::size_t capacity_) : capacity(capacity_) {}
+
+std::size_t CacheBudget::GetCapacity() const {
+    return capacity;
+}
+
+std::size_t CacheBudget::GetUsedBytes() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return used;
+}
+
+BlockCache::BlockCache(std::shared_ptr<FileInterface> base_, std::size_t block_size_,
+                       std::shared_ptr<CacheBudget> budget_)
+    : BlockFile(base_->file_size, block_size_), base(std::move(base_)),
+      budget(std::move(budget_)) {}
+
+BlockCache::~BlockCache() {
+    std::lock_guard<std::mutex> lock(budget->mutex);
+    for (const auto& block : blocks) {
+        budget->used -= block.second->data.size();
+        budget->entries.erase(block.second);
+    }
+}
+
+bytes BlockCache::ReadBlock(std::size_t block_index) {
+    bytes result(block_size);
+    ReadBlocks(block_index, 1, result.data());
+    return result;
+}
+
+void BlockCache::WriteBlock(std::size_t block_index, const bytes& data) {
+    WriteBlocks(block_index, 1, data.data());
+}
+
+void BlockCache::ReadBlocks(std::size_t first, std::size_t count, u8* dst) {
+    std::size_t i = 0;
+    while (i < count) {
+        if (Lookup(first + i, dst + i * block_size)) {
+            ++i;
+            continue;
+        }
+        // Read the run of missing blocks up to the next cached one with one call.
+        std::size_t end = i + 1;
+        bool hit = false;
+        while (end < count && !(hit = Lookup(first + end, dst + end * block_size)))
+            ++end;
+        std::size_t offset = (first + i) * block_size;
+        std::size_t upper = std::min((first + end) * block_size, file_size);
+        u8* run = dst + i * block_size;
+        base->Read(offset, upper - offset, run);
+        std::fill(run + (upper - offset), dst + end * block_size, 0);
+        if (stats)
+            stats->cache_misses += end - i;
+        for (; i < end; ++i)
+            Insert(first + i, dst + i * block_size);
+        if (hit)
+            ++i;
+    }
+}
+
+void BlockCache::WriteBlocks(std::size_t first, std::size_t count, const u8* src) {
+    std::size_t offset = first * block_size;
+    std::size_t upper = std::min(offset + count * block_size, file_size);
+    base->Write(offset, upper - offset, src);
+    for (std::size_t i = 0; i < count; ++i)
+        Insert(first + i, src + i * block_size);
+}
+
+bool BlockCache::Lookup(std::size_t block, u8* dst) {
+    std::lock_guard<std::mutex> lock(budget->mutex);
+    auto found = blocks.find(block);
+    if (found == blocks.end())
+        return false;
+    auto& entries = budget->entries;
+    entries.splice(entries.begin(), entries, found->second);
+    std::memcpy(dst, found->second->data.data(), block_size);
+    if (stats)
+        ++stats->cache_hits;
+    return true;
+}
+
+void BlockCache::Insert(std::size_t block, const u8* src) {
+    std::lock_guard<std::mutex> lock(budget->mutex);
+    auto& entries = budget->entries;
+    auto found = blocks.find(block);
+    if (found != blocks.end()) {
+        entries.splice(entries.begin(), entries, found->second);
+        std::memcpy(found->second->data.data(), src, block_size);
+        return;
+    }
+    if (block_size > budget->capacity)
+        return;
+
+    // Evict the least recently used blocks until this one fits, and reuse the list node and buffer
+    // of the last one.
+    std::list<CacheBudget::Entry> spare;
+    while (budget->used + block_size > budget->capacity) {
+        auto victim = std::prev(entries.end());
+        victim->owner->blocks.erase(victim->block);
+        if (victim->owner->stats)
+            ++victim->owner->stats->cache_evictions;
+        budget->used -= victim->data.size();
+        spare.clear();
+        spare.splice(spare.begin(), entries, victim);
+    }
+    if (spare.empty())
+        spare.emplace_back();
+    CacheBudget::Entry& entry = spare.front();
+    entry.owner = this;
+    entry.block = block;
+    entry.data.resize(block_size);
+    std::memcpy(entry.data.data(), src, block_size);
+    entries.splice(entries.begin(), spare);
+    blocks.emplace(block, entries.begin());
+    budget->used += block_size;
+}
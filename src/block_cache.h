@@ -0,0 +1,59 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "block_file.h"
+
+class BlockCache;
+
+// A memory budget shared by the BlockCache layers of any number of images. Once it is used up,
+// the least recently used block of any of them makes room for a new one.
+class CacheBudget {
+public:
+    CacheBudget(std::size_t capacity_);
+
+    std::size_t GetCapacity() const;
+    std::size_t GetUsedBytes();
+
+private:
+    friend class BlockCache;
+
+    struct Entry {
+        BlockCache* owner;
+        std::size_t block;
+        bytes data;
+    };
+
+    const std::size_t capacity;
+    std::mutex mutex;
+    // Most recently used first.
+    std::list<Entry> entries;
+    std::size_t used = 0;
+};
+
+// Keeps recently used blocks of `base` in RAM, within `budget`. Writes go through to `base` at
+// once, so nothing is lost when a block is evicted.
+class BlockCache final : public BlockFile {
+public:
+    BlockCache(std::shared_ptr<FileInterface> base_, std::size_t block_size_,
+               std::shared_ptr<CacheBudget> budget_);
+    ~BlockCache();
+
+protected:
+    bytes ReadBlock(std::size_t block_index) override;
+    void WriteBlock(std::size_t block_index, const bytes& data) override;
+    void ReadBlocks(std::size_t first, std::size_t count, u8* dst) override;
+    void WriteBlocks(std::size_t first, std::size_t count, const u8* src) override;
+
+private:
+    std::shared_ptr<FileInterface> base;
+    std::shared_ptr<CacheBudget> budget;
+    // Guarded by the budget's mutex, since any cache sharing it may evict from here.
+    std::unordered_map<std::size_t, std::list<CacheBudget::Entry>::iterator> blocks;
+
+    // Copies block `block` to `dst` if it is cached.
+    bool Lookup(std::size_t block, u8* dst);
+    void Insert(std::size_t block, const u8* src);
+};
@@ -1,38 +1,78 @@
+#include <algorithm>
 #include "alignment.h"
 #include "block_file.h"
 
+static unsigned GetShift(std::size_t size) {
+    if (!IsPowerOfTwo(size))
+        return ~0u;
+    unsigned shift = 0;
+    while (((std::size_t)1 << shift) != size)
+        ++shift;
+    return shift;
+}
+
 BlockFile::BlockFile(std::size_t file_size_, std::size_t block_size_)
-    : FileInterface(file_size_), block_size(block_size_) {}
+    : FileInterface(file_size_), block_size(block_size_), block_shift(GetShift(block_size_)) {}
+
+std::size_t BlockFile::GetBlockCount() const {
+    return GetBlockIndex(AlignUp(file_size, block_size));
+}
 
-bytes BlockFile::ReadImpl(std::size_t offset, std::size_t size) {
+void BlockFile::ReadIntoImpl(std::size_t offset, std::size_t size, u8* dst) {
+    if (size == 0)
+        return;
+    std::size_t end = offset + size;
     std::size_t lower = AlignDown(offset, block_size);
-    std::size_t upper = AlignUp(offset + size, block_size);
-    bytes result;
-    for (std::size_t pos = lower; pos < upper; pos += block_size) {
-        result += ReadBlock(pos / block_size);
+    std::size_t cur = offset;
+
+    // Whole blocks are read straight into `dst`, partial ones at either end through `scratch`.
+    if (offset != lower || end < lower + block_size) {
+        scratch.resize(block_size);
+        ReadBlocks(GetBlockIndex(lower), 1, scratch.data());
+        std::size_t copy_end = std::min(lower + block_size, end);
+        std::memcpy(dst, scratch.data() + (offset - lower), copy_end - offset);
+        cur = copy_end;
+    }
+    std::size_t full_end = AlignDown(end, block_size);
+    if (cur < full_end) {
+        ReadBlocks(GetBlockIndex(cur), GetBlockIndex(full_end - cur), dst + (cur - offset));
+        cur = full_end;
+    }
+    if (cur < end) {
+        scratch.resize(block_size);
+        ReadBlocks(GetBlockIndex(cur), 1, scratch.data());
+        std::memcpy(dst + (cur - offset), scratch.data(), end - cur);
     }
-    result.erase(result.begin(), result.begin() + (offset - lower));
-    result.resize(size);
-    return result;
 }
 
-void BlockFile::WriteImpl(std::size_t offset, const bytes& data) {
-    std::size_t end = offset + data.size();
+void BlockFile::WriteFromImpl(std::size_t offset, std::size_t size, const u8* src) {
+    std::size_t end = offset + size;
     std::size_t lower = AlignDown(offset, block_size);
     std::size_t upper = AlignUp(end, block_size);
-    bytes buffer;
-    if (lower != offset) {
-        buffer = ReadBlock(lower / block_size);
-        buffer.resize(offset - lower);
+    if (lower == offset && upper == end) {
+        WriteBlocks(GetBlockIndex(lower), GetBlockIndex(upper - lower), src);
+        return;
     }
-    buffer += data;
-    if (upper != end) {
-        auto last = ReadBlock(upper / block_size - 1);
-        last.erase(last.begin(), last.begin() + (block_size - (upper - end)));
-        buffer += last;
-    }
-    for (std::size_t pos = lower; pos < upper; pos += block_size) {
-        WriteBlock(pos / block_size,
-                   bytes(buffer.begin() + pos - lower, buffer.begin() + pos - lower + block_size));
+
+    // Only partially written blocks are read back. The tail of the last block past the end of the
+    // file is not stored, so a write reaching the end of the file does not need it.
+    scratch.assign(upper - lower, 0);
+    if (lower != offset)
+        ReadBlocks(GetBlockIndex(lower), 1, scratch.data());
+    if (upper != end && end != file_size && (upper - lower > block_size || lower == offset))
+        ReadBlocks(GetBlockIndex(upper) - 1, 1, scratch.data() + scratch.size() - block_size);
+    std::memcpy(scratch.data() + (offset - lower), src, size);
+    WriteBlocks(GetBlockIndex(lower), GetBlockIndex(upper - lower), scratch.data());
+}
+
+void BlockFile::ReadBlocks(std::size_t first, std::size_t count, u8* dst) {
+    for (std::size_t i = 0; i < count; ++i) {
+        auto block = ReadBlock(first + i);
+        std::copy(block.begin(), block.end(), dst + i * block_size);
     }
 }
+
+void BlockFile::WriteBlocks(std::size_t first, std::size_t count, const u8* src) {
+    for (std::size_t i = 0; i < count; ++i)
+        WriteBlock(first + i, bytes(src + i * block_size, src + (i + 1) * block_size));
+}
@@ -6,13 +6,33 @@ class BlockFile : public FileInterface {
 public:
     BlockFile(std::size_t file_size_, std::size_t block_size_);
 
+    std::size_t GetBlockCount() const;
+
 protected:
-    bytes ReadImpl(std::size_t offset, std::size_t size) override;
-    void WriteImpl(std::size_t offset, const bytes& data) override;
+    void ReadIntoImpl(std::size_t offset, std::size_t size, u8* dst) override;
+    void WriteFromImpl(std::size_t offset, std::size_t size, const u8* src) override;
 
     virtual bytes ReadBlock(std::size_t block_index) = 0;
     virtual void WriteBlock(std::size_t block_index, const bytes& data) = 0;
 
+    // Accesses blocks [first, first + count) through a buffer of count * block_size bytes. The
+    // default goes through ReadBlock() and WriteBlock() one block at a time; layers that can serve
+    // a run of blocks with fewer calls to their parent override these.
+    virtual void ReadBlocks(std::size_t first, std::size_t count, u8* dst);
+    virtual void WriteBlocks(std::size_t first, std::size_t count, const u8* src);
+
+    // Index of the block containing byte `offset`. This is a shift when the block size is a power
+    // of two, and a division otherwise.
+    std::size_t GetBlockIndex(std::size_t offset) const {
+        return block_shift != NoShift ? offset >> block_shift : offset / block_size;
+    }
+
 protected:
     const std::size_t block_size;
+    // Partial blocks of the current access. Kept to reuse its allocation.
+    bytes scratch;
+
+private:
+    static constexpr unsigned NoShift = ~0u;
+    const unsigned block_shift;
 };
@@ -0,0 +1,292 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "bulk.h"
+#include "thread_pool.h"
+
+// Files are moved in batches of about this many bytes, so that host I/O of a batch runs in
+// parallel while memory use stays bounded.
+static constexpr std::size_t BatchBytes = 0x4000000;
+
+struct BulkFile {
+    std::string fs_path;
+    std::string host_path;
+    u32 index;       // ExtractTree: the file
+    std::size_t dir; // PackTree: the BulkDir to create the file in
+    FsName name;
+    std::size_t size;
+    bytes data;
+};
+
+// A directory of the host tree in PackTree, in a list where parents come before their children.
+struct BulkDir {
+    std::string fs_path;
+    std::size_t parent;
+    FsName name;
+    u32 index; // 0 until a directory missing in the image is created
+};
+
+static bool MakeHostDir(const std::string& path) {
+    if (::mkdir(path.c_str(), 0755) == 0 || errno == EEXIST)
+        return true;
+    std::fprintf(stderr, "Failed to create %s: %s\n", path.c_str(), std::strerror(errno));
+    return false;
+}
+
+static bool WriteHostFile(const BulkFile& file) {
+    std::FILE* handle = std::fopen(file.host_path.c_str(), "wb");
+    bool ok = handle && (file.data.empty() ||
+                         std::fwrite(file.data.data(), file.data.size(), 1, handle) == 1);
+    if (handle && std::fclose(handle) != 0)
+        ok = false;
+    if (!ok)
+        std::fprintf(stderr, "Failed to write %s\n", file.host_path.c_str());
+    return ok;
+}
+
+static bool ReadHostFile(BulkFile& file) {
+    std::FILE* handle = std::fopen(file.host_path.c_str(), "rb");
+    file.data.resize(file.size);
+    bool ok = handle && (file.data.empty() ||
+                         std::fread(file.data.data(), file.data.size(), 1, handle) == 1);
+    if (handle)
+        std::fclose(handle);
+    if (!ok)
+        std::fprintf(stderr, "Failed to read %s\n", file.host_path.c_str());
+    return ok;
+}
+
+// Returns the end of the batch that starts at `first`.
+static std::size_t NextBatch(const std::vector<BulkFile>& files, std::size_t first) {
+    std::size_t end = first + 1;
+    std::size_t batch_bytes = files[first].size;
+    while (end < files.size() && batch_bytes + files[end].size <= BatchBytes)
+        batch_bytes += files[end++].size;
+    return end;
+}
+
+static bool CollectFsTree(FsInterface& fs, const std::string& fs_path, u32 index,
+                          const std::string& host_dir, std::vector<BulkFile>& files) {
+    if (!MakeHostDir(host_dir))
+        return false;
+    bool ok = true;
+    for (const FsName& name : fs.ListSubDir(index)) {
+        std::string sub_path = fs_path + "/" + NameToString(name);
+        if (!IsHostSafeName(NameToString(name))) {
+            std::fprintf(stderr, "Skipping %s\n", sub_path.c_str());
+            ok = false;
+            continue;
+        }
+        FsStat stat = fs.Find(sub_path.c_str());
+        if (stat.result != FsResult::DirExists) {
+            std::fprintf(stderr, "Failed to read %s\n", sub_path.c_str());
+            ok = false;
+            continue;
+        }
+        ok = CollectFsTree(fs, sub_path, stat.index, host_dir + "/" + NameToString(name), files) &&
+             ok;
+    }
+    for (const FsName& name : fs.ListSubFile(index)) {
+        BulkFile file;
+        file.fs_path = fs_path + "/" + NameToString(name);
+        if (!IsHostSafeName(NameToString(name))) {
+            std::fprintf(stderr, "Skipping %s\n", file.fs_path.c_str());
+            ok = false;
+            continue;
+        }
+        file.host_path = host_dir + "/" + NameToString(name);
+        FsStat stat = fs.Find(file.fs_path.c_str());
+        if (stat.result != FsResult::FileExists) {
+            std::fprintf(stderr, "Failed to read %s\n", file.fs_path.c_str());
+            ok = false;
+            continue;
+        }
+        file.index = stat.index;
+        file.size = fs.GetFileSize(file.index);
+        files.push_back(std::move(file));
+    }
+    return ok;
+}
+
+bool ExtractTree(FsInterface& fs, const std::string& host_dir, unsigned jobs) {
+    std::vector<BulkFile> files;
+    bool ok = CollectFsTree(fs, "", 1, host_dir, files);
+    ThreadPool pool(jobs > 1 ? jobs - 1 : 0);
+    for (std::size_t first = 0; first < files.size();) {
+        std::size_t end = NextBatch(files, first);
+        for (std::size_t i = first; i < end; ++i) {
+            BulkFile& file = files[i];
+            FsFileInterface* handle = fs.Open(file.index);
+            file.data.resize(file.size);
+            if (!handle || handle->Read(0, file.size, file.data.data()) != file.size) {
+                std::fprintf(stderr, "Failed to read %s\n", file.fs_path.c_str());
+                ok = false;
+            }
+            if (handle)
+                handle->Close();
+        }
+        std::vector<char> written(end - first);
+        pool.ParallelFor(end - first, [&](std::size_t i) {
+            written[i] = WriteHostFile(files[first + i]);
+            files[first + i].data = bytes();
+        });
+        for (char w : written)
+            ok = ok && w;
+        first = end;
+    }
+    return ok;
+}
+
+// Lists the host directory `host_dir` into `dirs` and `files`, below dirs[dir], without changing
+// the image.
+static bool CollectHostTree(FsInterface& fs, std::size_t dir, const std::string& host_dir,
+                            std::vector<BulkDir>& dirs, std::vector<BulkFile>& files) {
+    DIR* handle = opendir(host_dir.c_str());
+    if (!handle) {
+        std::fprintf(stderr, "Failed to open %s: %s\n", host_dir.c_str(), std::strerror(errno));
+        return false;
+    }
+    bool ok = true;
+    while (dirent* entry = readdir(handle)) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+        std::string host_path = host_dir + "/" + name;
+        std::string sub_path = dirs[dir].fs_path + "/" + name;
+        struct stat host_stat;
+        if (name.size() > 16 || ::lstat(host_path.c_str(), &host_stat) != 0) {
+            std::fprintf(stderr, "Skipping %s\n", host_path.c_str());
+            ok = false;
+            continue;
+        }
+
+        FsName fs_name{};
+        std::memcpy(fs_name.data(), name.data(), name.size());
+        FsStat stat = fs.Find(sub_path.c_str());
+        if (S_ISDIR(host_stat.st_mode)) {
+            // Below a directory that is not in the image yet, nothing is found.
+            bool missing = stat.result == FsResult::NotFound ||
+                           (stat.result == FsResult::PathNotFound && dirs[dir].index == 0);
+            if (stat.result != FsResult::DirExists && !missing) {
+                std::fprintf(stderr, "Failed to create directory %s\n", sub_path.c_str());
+                ok = false;
+                continue;
+            }
+            dirs.push_back({sub_path, dir, fs_name, missing ? 0 : stat.index});
+            ok = CollectHostTree(fs, dirs.size() - 1, host_path, dirs, files) && ok;
+        } else if (S_ISREG(host_stat.st_mode)) {
+            if (stat.result == FsResult::DirExists) {
+                std::fprintf(stderr, "%s is a directory in the image\n", sub_path.c_str());
+                ok = false;
+                continue;
+            }
+            BulkFile file;
+            file.fs_path = sub_path;
+            file.host_path = host_path;
+            file.dir = dir;
+            file.name = fs_name;
+            file.size = host_stat.st_size;
+            files.push_back(std::move(file));
+        } else {
+            std::fprintf(stderr, "Skipping %s\n", host_path.c_str());
+            ok = false;
+        }
+    }
+    closedir(handle);
+    return ok;
+}
+
+// Blocks that `file` takes now, which are freed when it is replaced.
+static u64 ReplacedBlocks(Disa& disa, const BulkFile& file) {
+    FsStat stat = disa.Find(file.fs_path.c_str());
+    if (stat.result != FsResult::FileExists)
+        return 0;
+    return disa.CountBlocks(disa.GetFileSize(stat.index));
+}
+
+bool PackTree(Disa& disa, const std::string& host_dir, unsigned jobs) {
+    std::vector<BulkDir> dirs{{"", 0, {}, 1}};
+    std::vector<BulkFile> files;
+    bool ok = CollectHostTree(disa, 0, host_dir, dirs, files);
+
+    // Running out of blocks would assert in the FAT, and running out of entries would leave the
+    // tree half imported, so check the whole tree before anything is written.
+    u64 free_blocks = disa.GetFreeBlockCount();
+    u64 needed_blocks = 0;
+    u64 needed_dirs = 0;
+    u64 needed_files = 0;
+    for (const BulkDir& dir : dirs)
+        needed_dirs += dir.index == 0;
+    for (const BulkFile& file : files) {
+        free_blocks += ReplacedBlocks(disa, file);
+        needed_blocks += disa.CountBlocks(file.size);
+        needed_files += disa.Find(file.fs_path.c_str()).result != FsResult::FileExists;
+    }
+    if (needed_blocks > free_blocks || needed_dirs > disa.GetFreeDirCount() ||
+        needed_files > disa.GetFreeFileCount()) {
+        std::fprintf(stderr,
+                     "No room for %s: needs 0x%llX blocks, 0x%llX directories and 0x%llX "
+                     "files, 0x%llX, 0x%X and 0x%X free\n",
+                     host_dir.c_str(), (unsigned long long)needed_blocks,
+                     (unsigned long long)needed_dirs, (unsigned long long)needed_files,
+                     (unsigned long long)free_blocks, disa.GetFreeDirCount(),
+                     disa.GetFreeFileCount());
+        return false;
+    }
+
+    disa.BeginBatch();
+    for (BulkDir& dir : dirs) {
+        if (dir.index == 0 && dirs[dir.parent].index != 0)
+            dir.index = disa.MakeDir(dir.name, dirs[dir.parent].index);
+        if (dir.index == 0) {
+            std::fprintf(stderr, "Failed to create directory %s\n", dir.fs_path.c_str());
+            ok = false;
+        }
+    }
+
+    // Files are replaced one at a time, so track the free blocks as they go too.
+    free_blocks = disa.GetFreeBlockCount();
+    ThreadPool pool(jobs > 1 ? jobs - 1 : 0);
+    for (std::size_t first = 0; first < files.size();) {
+        std::size_t end = NextBatch(files, first);
+        std::vector<char> read(end - first);
+        pool.ParallelFor(end - first,
+                         [&](std::size_t i) { read[i] = ReadHostFile(files[first + i]); });
+        for (std::size_t i = first; i < end; ++i) {
+            BulkFile& file = files[i];
+            u32 parent = dirs[file.dir].index;
+            if (!read[i - first] || parent == 0) {
+                ok = false;
+                file.data = bytes();
+                continue;
+            }
+            u64 available_blocks = free_blocks + ReplacedBlocks(disa, file);
+            if (disa.CountBlocks(file.size) > available_blocks) {
+                std::fprintf(stderr, "No room for %s\n", file.fs_path.c_str());
+                ok = false;
+                file.data = bytes();
+                continue;
+            }
+            FsStat stat = disa.Find(file.fs_path.c_str());
+            if (stat.result == FsResult::FileExists)
+                disa.RemoveFile(stat.index);
+            u32 index = disa.MakeFile(file.name, parent);
+            if (index == 0) {
+                std::fprintf(stderr, "No room for %s\n", file.fs_path.c_str());
+                ok = false;
+                continue;
+            }
+            free_blocks = available_blocks - disa.CountBlocks(file.size);
+            FsFileInterface* handle = disa.Open(index);
+            if (!file.data.empty())
+                handle->Write(0, file.data.size(), file.data.data());
+            handle->Close();
+            file.data = bytes();
+        }
+        first = end;
+    }
+    disa.CommitBatch();
+    return ok;
+}
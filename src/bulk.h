@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+#include "disa.h"
+#include "fs_interface.h"
+
+// Copies every directory and file of `fs` into the host directory `host_dir`, which is created if
+// needed. File data is read through `fs` on the calling thread and written to the host by `jobs`
+// threads. Returns false if any entry could not be copied.
+bool ExtractTree(FsInterface& fs, const std::string& host_dir, unsigned jobs);
+
+// Imports the host directory tree `host_dir` into the root of `disa`, replacing files that already
+// exist. Host files are read by `jobs` threads, and all writes are done in one batch that is
+// hashed at the end. If the tree needs more blocks, directories or files than are free, nothing is
+// written. Returns false if any entry could not be imported.
+bool PackTree(Disa& disa, const std::string& host_dir, unsigned jobs);
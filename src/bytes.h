@@ -21,13 +21,30 @@ T Decode(const bytes& data) {
     return result;
 }
 
-template <typename T>
-T Pop(bytes& data) {
-    T result;
-    std::memcpy(&result, data.data(), sizeof(T));
-    data.erase(data.begin(), data.begin() + sizeof(T));
-    return result;
-}
+// Decodes values in order from a buffer it does not own.
+class ByteReader {
+public:
+    ByteReader(const bytes& data_) : ByteReader(data_.data(), data_.size()) {}
+    ByteReader(const u8* data_, std::size_t size_) : data(data_), size(size_) {}
+
+    template <typename T>
+    T Read() {
+        assert(cursor + sizeof(T) <= size);
+        T result;
+        std::memcpy(&result, data + cursor, sizeof(T));
+        cursor += sizeof(T);
+        return result;
+    }
+
+    std::size_t GetRemaining() const {
+        return size - cursor;
+    }
+
+private:
+    const u8* data;
+    std::size_t size;
+    std::size_t cursor = 0;
+};
 
 template <typename T>
 bytes Encode(T t) {
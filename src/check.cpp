@@ -0,0 +1,617 @@
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include "alignment.h"
+#include "check.h"
+#include "crypto.h"
+#include "dpfs_level.h"
+#include "fat.h"
+#include "fs_interface.h"
+#include "metadata_table.h"
+#include "save_headers.h"
+#include "sub_file.h"
+
+// Bad blocks listed individually per IVFC level; the rest are only counted.
+static constexpr std::size_t MaxListedBlocks = 16;
+
+static constexpr u32 NoBlock = 0x80000000;
+
+static std::string Format(const char* format, ...) {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    std::vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    return buffer;
+}
+
+static std::string Escape(const std::string& text) {
+    std::string result;
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            result += '\\';
+        if ((unsigned char)c < 0x20)
+            continue;
+        result += c;
+    }
+    return result;
+}
+
+static u32 GetU32(const bytes& data, std::size_t offset) {
+    u32 result;
+    std::memcpy(&result, data.data() + offset, 4);
+    return result;
+}
+
+bool CheckReport::IsClean() const {
+    return problems.empty();
+}
+
+std::string CheckReport::ToJson(const std::string& image) const {
+    std::string json = "{\n  \"image\": \"" + Escape(image) + "\",\n  \"clean\": " +
+                       (IsClean() ? "true" : "false") + ",\n  \"counts\": {";
+    for (std::size_t i = 0; i < counts.size(); ++i) {
+        json += (i ? ",\n    \"" : "\n    \"") + Escape(counts[i].first) +
+                "\": " + std::to_string(counts[i].second);
+    }
+    json += "\n  },\n  \"problems\": [";
+    for (std::size_t i = 0; i < problems.size(); ++i) {
+        json += (i ? ",\n    {\"where\": \"" : "\n    {\"where\": \"") +
+                Escape(problems[i].where) + "\", \"what\": \"" + Escape(problems[i].what) + "\"}";
+    }
+    json += "\n  ]\n}\n";
+    return json;
+}
+
+class DisaChecker {
+public:
+    DisaChecker(std::shared_ptr<FileInterface> container, ThreadPool& pool)
+        : container(std::move(container)), pool(pool) {}
+
+    CheckReport report;
+
+    void Check(AesCmacBlockProvider* block_provider, const bytes& key);
+
+private:
+    std::shared_ptr<FileInterface> container;
+    ThreadPool& pool;
+
+    // The FAT, and which chain owns each block: 0 for none, else an index into owner_names.
+    bytes fat;
+    u32 block_count = 0;
+    std::vector<u32> owners;
+    std::vector<std::string> owner_names;
+
+    void Problem(const std::string& where, const std::string& what) {
+        report.problems.push_back({where, what});
+    }
+
+    void Count(const std::string& name, u64 value) {
+        report.counts.emplace_back(name, value);
+    }
+
+    // Returns [offset, offset + size) of `parent`, or nullptr after reporting a problem if that is
+    // out of bounds.
+    std::shared_ptr<FileInterface> Sub(const std::string& where,
+                                       std::shared_ptr<FileInterface> parent, u64 offset,
+                                       u64 size) {
+        if (offset > parent->file_size || size > parent->file_size - offset) {
+            Problem(where, Format("region 0x%llX+0x%llX is out of bounds (0x%zX)",
+                                  (unsigned long long)offset, (unsigned long long)size,
+                                  parent->file_size));
+            return nullptr;
+        }
+        return std::make_shared<SubFile>(std::move(parent), offset, size);
+    }
+
+    std::shared_ptr<FileInterface> CheckPartition(const std::string& name,
+                                                  std::shared_ptr<FileInterface> descriptor,
+                                                  std::shared_ptr<FileInterface> body);
+    void CheckLevel(const std::string& where, FileInterface& hash, FileInterface& body,
+                    u64 block_size);
+    void CheckFs(std::shared_ptr<FileInterface> save, std::shared_ptr<FileInterface> data);
+
+    bool ReadFatNode(const std::string& where, u32 block, u32& prev, u32& next, u32& size);
+    u64 CheckChain(const std::string& name, u32 start, u64 expected_blocks);
+};
+
+void DisaChecker::Check(AesCmacBlockProvider* block_provider, const bytes& key) {
+    if (container->file_size < 0x200) {
+        Problem("header", "image is too small");
+        return;
+    }
+    auto header_file = std::make_shared<SubFile>(container, 0x100, 0x100);
+    bytes header = header_file->Read(0, 0x100);
+    if (block_provider) {
+        bool good = container->Read(0, 0x10) == Crypto::AesCmac(block_provider->Hash(header), key);
+        if (!good)
+            Problem("header", "CMAC does not match");
+        Count("header/cmac_checked", 1);
+    }
+
+    auto disa = ByteReader(header).Read<DisaHeader>();
+    if (disa.magic != DisaHeader::Magic || disa.version != DisaHeader::Version) {
+        Problem("header", "bad DISA magic or version");
+        return;
+    }
+    if (disa.partition_count != 1 && disa.partition_count != 2) {
+        Problem("header",
+                Format("bad partition count %llu", (unsigned long long)disa.partition_count));
+        return;
+    }
+    if (disa.active_table > 1) {
+        Problem("header", Format("bad active table %u", disa.active_table));
+        return;
+    }
+
+    auto table = Sub("table", container,
+                     disa.active_table ? disa.table_sec_offset : disa.table_pri_offset,
+                     disa.table_size);
+    if (!table || disa.table_size == 0)
+        return;
+    SubFile table_hash(header_file, sizeof(DisaHeader), 0x20);
+    CheckLevel("table", table_hash, *table, disa.table_size);
+
+    std::shared_ptr<FileInterface> partitions[2];
+    for (u64 i = 0; i < disa.partition_count; ++i) {
+        std::string name = i == 0 ? "save" : "data";
+        auto descriptor =
+            Sub(name, table, disa.partition_entry[i].offset, disa.partition_entry[i].size);
+        auto body = Sub(name, container, disa.partition[i].offset, disa.partition[i].size);
+        if (!descriptor || !body)
+            return;
+        partitions[i] = CheckPartition(name, std::move(descriptor), std::move(body));
+        if (!partitions[i])
+            return;
+    }
+    CheckFs(partitions[0], partitions[1]);
+}
+
+std::shared_ptr<FileInterface> DisaChecker::CheckPartition(
+    const std::string& name, std::shared_ptr<FileInterface> descriptor,
+    std::shared_ptr<FileInterface> body) {
+    if (descriptor->file_size < sizeof(DifiHeader)) {
+        Problem(name, "DIFI header is truncated");
+        return nullptr;
+    }
+    auto difi = Decode<DifiHeader>(descriptor->Read(0, sizeof(DifiHeader)));
+    if (difi.magic != DifiHeader::Magic || difi.version != DifiHeader::Version) {
+        Problem(name, "bad DIFI magic or version");
+        return nullptr;
+    }
+    if (difi.external_ivfc_l4 > 1 || difi.dpfs_selector > 1) {
+        Problem(name, "bad DIFI flags");
+        return nullptr;
+    }
+
+    auto dpfs_file = Sub(name + "/dpfs", descriptor, difi.dpfs_desc.offset, difi.dpfs_desc.size);
+    auto ivfc_file = Sub(name + "/ivfc", descriptor, difi.ivfc_desc.offset, difi.ivfc_desc.size);
+    auto ivfc_l0 =
+        Sub(name + "/ivfc_l1", descriptor, difi.master_hash.offset, difi.master_hash.size);
+    if (!dpfs_file || !ivfc_file || !ivfc_l0)
+        return nullptr;
+    if (difi.dpfs_desc.size < sizeof(DpfsDescriptor) ||
+        difi.ivfc_desc.size < sizeof(IvfcDescriptor)) {
+        Problem(name, "DPFS or IVFC descriptor is truncated");
+        return nullptr;
+    }
+
+    // Each DPFS level selects, per block of the level below, which of its two copies is current.
+    auto dpfs = Decode<DpfsDescriptor>(dpfs_file->Read(0, sizeof(DpfsDescriptor)));
+    if (dpfs.magic != DpfsDescriptor::Magic || dpfs.version != DpfsDescriptor::Version) {
+        Problem(name + "/dpfs", "bad DPFS magic or version");
+        return nullptr;
+    }
+    std::shared_ptr<FileInterface> level;
+    for (int i = 0; i < 3; ++i) {
+        std::string where = name + "/dpfs_l" + std::to_string(i + 1);
+        const LevelDescriptor& desc = dpfs.levels[i];
+        if (desc.size > body->file_size / 2) {
+            Problem(where, "level is larger than the partition");
+            return nullptr;
+        }
+        if (!Sub(where, body, desc.offset, desc.size * 2))
+            return nullptr;
+        if (i == 0) {
+            level = Sub(where, body, desc.offset + desc.size * difi.dpfs_selector, desc.size);
+            continue;
+        }
+        if (desc.log2_block_size >= 32) {
+            Problem(where, "bad block size");
+            return nullptr;
+        }
+        u64 blocks = AlignUp<u64>(desc.size, 1ull << desc.log2_block_size) >> desc.log2_block_size;
+        if (AlignUp<u64>(blocks, 32) / 8 > level->file_size) {
+            Problem(where, Format("selector of 0x%zX bytes does not cover %llu blocks",
+                                  level->file_size, (unsigned long long)blocks));
+            return nullptr;
+        }
+        level = std::make_shared<DpfsLevel>(level, Sub(where, body, desc.offset, desc.size * 2),
+                                            1ull << desc.log2_block_size);
+    }
+    Count(name + "/dpfs_l3/bytes", level->file_size);
+
+    auto ivfc = Decode<IvfcDescriptor>(ivfc_file->Read(0, sizeof(IvfcDescriptor)));
+    if (ivfc.magic != IvfcDescriptor::Magic || ivfc.version != IvfcDescriptor::Version) {
+        Problem(name + "/ivfc", "bad IVFC magic or version");
+        return nullptr;
+    }
+    if (ivfc.master_hash_size != difi.master_hash.size)
+        Problem(name + "/ivfc", "master hash size does not match DIFI header");
+    std::shared_ptr<FileInterface> hash = ivfc_l0;
+    for (int i = 0; i < 4; ++i) {
+        std::string where = name + "/ivfc_l" + std::to_string(i + 1);
+        const LevelDescriptor& desc = ivfc.levels[i];
+        if (desc.log2_block_size >= 32) {
+            Problem(where, "bad block size");
+            return nullptr;
+        }
+        auto body_level = i == 3 && difi.external_ivfc_l4
+                              ? Sub(where, body, difi.ivfc_l4_offset, desc.size)
+                              : Sub(where, level, desc.offset, desc.size);
+        if (!body_level)
+            return nullptr;
+        CheckLevel(where, *hash, *body_level, 1ull << desc.log2_block_size);
+        hash = std::move(body_level);
+    }
+    return hash;
+}
+
+void DisaChecker::CheckLevel(const std::string& where, FileInterface& hash, FileInterface& body,
+                             u64 block_size) {
+    constexpr std::size_t pass_bytes = 0x400000;
+    constexpr std::size_t blocks_per_task = 8;
+    u64 block_count = AlignUp<u64>(body.file_size, block_size) / block_size;
+    Count(where + "/blocks", block_count);
+    if (block_count * 0x20 > hash.file_size) {
+        Problem(where, Format("%llu blocks but only 0x%zX bytes of hashes",
+                              (unsigned long long)block_count, hash.file_size));
+        return;
+    }
+
+    u64 bad_blocks = 0;
+    std::size_t blocks_per_pass = std::max<std::size_t>(1, pass_bytes / block_size);
+    for (u64 pass = 0; pass < block_count; pass += blocks_per_pass) {
+        std::size_t count = (std::size_t)std::min<u64>(blocks_per_pass, block_count - pass);
+        u64 offset = pass * block_size;
+        u64 end = std::min<u64>(offset + count * block_size, body.file_size);
+        bytes data = body.Read(offset, end - offset);
+        data.resize(count * block_size, 0);
+        bytes expected = hash.Read(pass * 0x20, count * 0x20);
+
+        bytes actual(count * 0x20);
+        pool.ParallelFor(AlignUp(count, blocks_per_task) / blocks_per_task, [&](std::size_t task) {
+            std::size_t first = task * blocks_per_task;
+            Crypto::Sha256Blocks(data.data() + first * block_size, block_size,
+                                 std::min(blocks_per_task, count - first),
+                                 actual.data() + first * 0x20);
+        });
+        for (std::size_t i = 0; i < count; ++i) {
+            if (std::memcmp(expected.data() + i * 0x20, actual.data() + i * 0x20, 0x20) == 0)
+                continue;
+            if (bad_blocks++ < MaxListedBlocks)
+                Problem(where, Format("block %llu does not match its hash",
+                                      (unsigned long long)(pass + i)));
+        }
+    }
+    if (bad_blocks > MaxListedBlocks) {
+        Problem(where, Format("%llu more blocks do not match their hash",
+                              (unsigned long long)(bad_blocks - MaxListedBlocks)));
+    }
+    Count(where + "/bad_blocks", bad_blocks);
+}
+
+// Reads the FAT node starting at `block`, checking the invariants that Fat::GetNode asserts.
+bool DisaChecker::ReadFatNode(const std::string& where, u32 block, u32& prev, u32& next,
+                              u32& size) {
+    // Entry i of the table describes block i - 1. Both halves are stored plus one, with the top
+    // bit as a flag.
+    auto entry = [this](u32 index, u32& u, u32& v, bool& u_flag, bool& v_flag) {
+        u = GetU32(fat, (index + 1) * 8);
+        v = GetU32(fat, (index + 1) * 8 + 4);
+        u_flag = u >= 0x80000000;
+        v_flag = v >= 0x80000000;
+        u = (u & 0x7FFFFFFF) - 1;
+        v = (v & 0x7FFFFFFF) - 1;
+    };
+    if (block >= block_count) {
+        Problem(where, Format("links to block %u past the end of the FAT", block));
+        return false;
+    }
+    u32 u, v;
+    bool u_flag, v_flag;
+    entry(block, u, v, u_flag, v_flag);
+    prev = u;
+    next = v;
+    size = 1;
+    if ((prev == NoIndex) != u_flag)
+        Problem(where, Format("node %u has an inconsistent start flag", block));
+    if (next != NoIndex && next >= block_count) {
+        Problem(where, Format("node %u links to block %u past the end of the FAT", block, next));
+        return false;
+    }
+    if (!v_flag)
+        return true;
+
+    u32 first, last, first2, last2;
+    bool first_flag, last_flag, unused;
+    if (block + 1 >= block_count) {
+        Problem(where, Format("node %u extends past the end of the FAT", block));
+        return false;
+    }
+    entry(block + 1, first, last, first_flag, unused);
+    if (!first_flag || first != block || last <= block || last >= block_count) {
+        Problem(where, Format("node %u has a bad extension entry", block));
+        return false;
+    }
+    entry(last, first2, last2, last_flag, unused);
+    if (!last_flag || first2 != block || last2 != last) {
+        Problem(where, Format("node %u has a bad last extension entry", block));
+        return false;
+    }
+    size = last - block + 1;
+    return true;
+}
+
+// Walks the chain starting at `start`, marking its blocks as owned by `name`, and returns its
+// block count. `expected_blocks` is checked unless it is ~0.
+u64 DisaChecker::CheckChain(const std::string& name, u32 start, u64 expected_blocks) {
+    u32 owner = (u32)owner_names.size();
+    owner_names.push_back(name);
+    u64 blocks = 0;
+    u32 previous = NoIndex;
+    for (u32 current = start; current != NoIndex;) {
+        u32 prev, next, size;
+        if (!ReadFatNode(name, current, prev, next, size))
+            break;
+        if (prev != previous)
+            Problem(name, Format("node %u links back to %u instead of %u", current, prev,
+                                 previous));
+        bool looped = false;
+        for (u32 block = current; block < current + size; ++block) {
+            if (owners[block] == owner) {
+                Problem(name, Format("chain loops back to block %u", block));
+                looped = true;
+                break;
+            }
+            if (owners[block] != 0) {
+                Problem(name, Format("block %u is also in %s", block,
+                                     owner_names[owners[block]].c_str()));
+            } else {
+                owners[block] = owner;
+            }
+        }
+        if (looped)
+            break;
+        blocks += size;
+        previous = current;
+        current = next;
+    }
+    if (expected_blocks != ~0ull && blocks != expected_blocks) {
+        Problem(name, Format("chain has %llu blocks instead of %llu", (unsigned long long)blocks,
+                             (unsigned long long)expected_blocks));
+    }
+    return blocks;
+}
+
+struct TableCheck {
+    const char* where;
+    std::size_t entry_size;
+    bytes entries;
+    bytes buckets;
+    u32 used = 0; // entries [1, used) are allocated or free
+    std::vector<bool> free;
+    std::vector<bool> reached;
+};
+
+void DisaChecker::CheckFs(std::shared_ptr<FileInterface> save,
+                          std::shared_ptr<FileInterface> data) {
+    if (save->file_size < sizeof(SaveHeader)) {
+        Problem("fs", "SAVE header is truncated");
+        return;
+    }
+    auto header = Decode<SaveHeader>(save->Read(0, sizeof(SaveHeader)));
+    if (header.magic != SaveHeader::Magic || header.version != SaveHeader::Version) {
+        Problem("fs", "bad SAVE magic or version");
+        return;
+    }
+    u32 block_size = header.block_size;
+    u64 dir_hash_offset = header.dir_hash_offset;
+    u32 dir_buckets = header.dir_buckets;
+    u64 file_hash_offset = header.file_hash_offset;
+    u32 file_buckets = header.file_buckets;
+    u64 fat_offset = header.fat_offset;
+    u32 fat_size = header.fat_size;
+    u64 data_region_offset = header.data_region_offset;
+    block_count = header.data_block_count;
+    TableLocation location[2] = {header.dir_table, header.file_table};
+    u64 table_offset[2];
+    u32 table_start[2], table_blocks[2];
+    u32 table_capacity[2] = {header.max_dirs + 2, header.max_files + 1};
+    for (int i = 0; i < 2; ++i) {
+        if (data) {
+            table_offset[i] = location[i].offset;
+        } else {
+            table_start[i] = location[i].chain.start_block;
+            table_blocks[i] = location[i].chain.block_count;
+            table_offset[i] = (u64)table_start[i] * block_size + data_region_offset;
+        }
+    }
+    if (block_size == 0 || fat_size != block_count || dir_buckets == 0 || file_buckets == 0) {
+        Problem("fs", "bad SAVE header geometry");
+        return;
+    }
+
+    auto fat_file = Sub("fs/fat", save, fat_offset, ((u64)block_count + 1) * 8);
+    auto data_region = data ? Sub("fs/data", data, 0, (u64)block_count * block_size)
+                            : Sub("fs/data", save, data_region_offset,
+                                  (u64)block_count * block_size);
+    TableCheck tables[2] = {{"fs/dir_table", 0x28}, {"fs/file_table", 0x30}};
+    u64 hash_offset[2] = {dir_hash_offset, file_hash_offset};
+    u32 bucket_count[2] = {dir_buckets, file_buckets};
+    bool ok = fat_file && data_region;
+    for (int i = 0; i < 2; ++i) {
+        auto entries = Sub(tables[i].where, save, table_offset[i],
+                           (u64)table_capacity[i] * tables[i].entry_size);
+        auto buckets = Sub(tables[i].where, save, hash_offset[i], (u64)bucket_count[i] * 4);
+        if (!entries || !buckets) {
+            ok = false;
+            continue;
+        }
+        tables[i].entries = entries->Read(0, entries->file_size);
+        tables[i].buckets = buckets->Read(0, buckets->file_size);
+    }
+    if (!ok)
+        return;
+    fat = fat_file->Read(0, fat_file->file_size);
+    owners.assign(block_count, 0);
+    owner_names.assign(1, "");
+
+    // Allocation state: entry 0 holds the used and maximum entry counts and heads the list of
+    // freed entries, which is linked through the last field.
+    for (TableCheck& table : tables) {
+        std::size_t capacity = table.entries.size() / table.entry_size;
+        u32 used = GetU32(table.entries, 0);
+        u32 max = GetU32(table.entries, 4);
+        if (used > max || max > capacity)
+            Problem(table.where, Format("used count %u, maximum %u, capacity %zu", used, max,
+                                        capacity));
+        table.used = std::min<u32>(used, (u32)capacity);
+        table.free.assign(capacity, false);
+        table.reached.assign(capacity, false);
+        u32 index = GetU32(table.entries, table.entry_size - 4);
+        while (index != 0) {
+            if (index >= table.used || table.free[index]) {
+                Problem(table.where, Format("free list is broken at entry %u", index));
+                break;
+            }
+            table.free[index] = true;
+            index = GetU32(table.entries, index * table.entry_size + table.entry_size - 4);
+        }
+    }
+
+    // The tree: sub-directories and files of a directory are linked through their next field.
+    TableCheck& dirs = tables[0];
+    auto live = [](const TableCheck& table, u32 index) {
+        return index != 0 && index < table.used && !table.free[index];
+    };
+    if (!live(dirs, 1)) {
+        Problem(dirs.where, "root directory is not allocated");
+        return;
+    }
+    struct File {
+        std::string path;
+        u64 size;
+        u32 block;
+    };
+    std::vector<File> file_list;
+    std::vector<std::pair<u32, std::string>> stack{{1, ""}};
+    dirs.reached[1] = true;
+    u64 dir_count = 0;
+    while (!stack.empty()) {
+        u32 dir = stack.back().first;
+        std::string path = stack.back().second;
+        stack.pop_back();
+        ++dir_count;
+        for (int is_file = 0; is_file < 2; ++is_file) {
+            TableCheck& table = tables[is_file];
+            u32 child = GetU32(dirs.entries, dir * dirs.entry_size + (is_file ? 0x1C : 0x18));
+            while (child != 0) {
+                if (!live(table, child) || table.reached[child]) {
+                    const char* state = live(table, child) ? "linked twice" : "not in use";
+                    Problem(table.where, Format("%s/ links to entry %u which is %s",
+                                                path.c_str(), child, state));
+                    break;
+                }
+                table.reached[child] = true;
+                const u8* entry = table.entries.data() + child * table.entry_size;
+                FsName name;
+                std::memcpy(name.data(), entry + 4, name.size());
+                std::string child_path = path + "/" + NameToString(name);
+                if (GetU32(table.entries, child * table.entry_size) != dir)
+                    Problem(table.where, child_path + " has a wrong parent");
+                if (is_file) {
+                    u64 size;
+                    u32 block;
+                    std::memcpy(&size, entry + 0x20, 8);
+                    std::memcpy(&block, entry + 0x1C, 4);
+                    file_list.push_back({child_path, size, block});
+                } else {
+                    stack.emplace_back(child, child_path);
+                }
+                child = GetU32(table.entries, child * table.entry_size + 0x14);
+            }
+        }
+    }
+    Count("fs/dirs", dir_count);
+    Count("fs/files", file_list.size());
+
+    // Every live entry except the root must be reachable from the root and from its hash bucket.
+    for (int t = 0; t < 2; ++t) {
+        TableCheck& table = tables[t];
+        u32 buckets = (u32)(table.buckets.size() / 4);
+        std::vector<bool> hashed(table.free.size(), false);
+        for (u32 bucket = 0; bucket < buckets; ++bucket) {
+            u32 index = GetU32(table.buckets, bucket * 4);
+            while (index != 0) {
+                if (!live(table, index) || hashed[index]) {
+                    const char* state = live(table, index) ? "linked twice" : "not in use";
+                    Problem(table.where, Format("bucket %u links to entry %u which is %s", bucket,
+                                                index, state));
+                    break;
+                }
+                hashed[index] = true;
+                const u8* entry = table.entries.data() + index * table.entry_size;
+                FsName name;
+                std::memcpy(name.data(), entry + 4, name.size());
+                u32 parent = GetU32(table.entries, index * table.entry_size);
+                u32 expected = GetMetadataBucket(name, parent, buckets);
+                if (expected != bucket)
+                    Problem(table.where, Format("entry %u is in bucket %u instead of %u", index,
+                                                bucket, expected));
+                index = GetU32(table.entries, index * table.entry_size + table.entry_size - 4);
+            }
+        }
+        for (u32 index = 1; index < table.used; ++index) {
+            if (table.free[index] || (t == 0 && index == 1))
+                continue;
+            if (!table.reached[index])
+                Problem(table.where, Format("entry %u is not linked into the tree", index));
+            if (!hashed[index])
+                Problem(table.where, Format("entry %u is not in its hash bucket", index));
+        }
+    }
+
+    // The FAT: every block belongs to exactly one file, entry table or the free list.
+    if (!data) {
+        CheckChain("fs/dir_table", table_start[0], table_blocks[0]);
+        CheckChain("fs/file_table", table_start[1], table_blocks[1]);
+    }
+    for (const File& file : file_list) {
+        u64 expected = AlignUp<u64>(file.size, block_size) / block_size;
+        if (file.block == NoBlock) {
+            if (file.size != 0)
+                Problem(file.path, "has data but no blocks");
+            continue;
+        }
+        CheckChain(file.path, file.block, expected);
+    }
+    u64 free_blocks = CheckChain("fs/free", GetU32(fat, 4) - 1, ~0ull);
+    u64 leaked = std::count(owners.begin(), owners.end(), 0u);
+    if (leaked != 0) {
+        u32 first = (u32)(std::find(owners.begin(), owners.end(), 0u) - owners.begin());
+        Problem("fs/fat", Format("%llu blocks are neither used nor free, the first is %u",
+                                 (unsigned long long)leaked, first));
+    }
+    Count("fat/blocks", block_count);
+    Count("fat/used_blocks", block_count - free_blocks - leaked);
+    Count("fat/free_blocks", free_blocks);
+}
+
+CheckReport CheckDisa(std::shared_ptr<FileInterface> container,
+                      AesCmacBlockProvider* block_provider, const bytes& key, ThreadPool& pool) {
+    DisaChecker checker(std::move(container), pool);
+    checker.Check(block_provider, key);
+    return std::move(checker.report);
+}
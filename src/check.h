@@ -0,0 +1,29 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "aes_cmac.h"
+#include "file_interface.h"
+#include "thread_pool.h"
+
+struct CheckReport {
+    struct Problem {
+        std::string where;
+        std::string what;
+    };
+    std::vector<Problem> problems;
+    // Named counts, e.g. "save/ivfc_l4/bad_blocks", in the order they were recorded.
+    std::vector<std::pair<std::string, u64>> counts;
+
+    bool IsClean() const;
+    std::string ToJson(const std::string& image) const;
+};
+
+// Checks the DISA image in `container` without trusting any of it: the header CMAC if
+// `block_provider` is given, the partition table and every IVFC level hash, the DPFS geometry, the
+// FAT chains and free list, and the directory and file tables with their hash buckets. Problems
+// are reported instead of asserted. Block hashing runs on `pool`.
+CheckReport CheckDisa(std::shared_ptr<FileInterface> container,
+                      AesCmacBlockProvider* block_provider, const bytes& key, ThreadPool& pool);
@@ -6,4 +6,23 @@ namespace Crypto {
 
 bytes Sha256(const bytes& data);
 bytes AesCmac(const bytes& data, const bytes& key);
+
+// Writes the 32-byte digest of `size` bytes at `data` to `out`.
+void Sha256(const u8* data, std::size_t size, u8* out);
+
+// Hashes `count` consecutive blocks of `block_size` bytes each, writing the digests back to back
+// to `out`. This is the fast path for IVFC levels, where many equal-size blocks are hashed at once.
+void Sha256Blocks(const u8* data, std::size_t block_size, std::size_t count, u8* out);
+
+// SHA-256 implementation selected at runtime. The best one supported by the CPU is picked at
+// startup; SetSha256Backend returns false if the requested one is not supported.
+enum class Sha256Backend {
+    Scalar,
+    ShaNi,
+    Avx2,
+};
+
+Sha256Backend GetSha256Backend();
+bool SetSha256Backend(Sha256Backend backend);
+const char* GetSha256BackendName(Sha256Backend backend);
 }
@@ -1,78 +1,75 @@
+#include "block_cache.h"
 #include "difi.h"
+#include "disa.h"
 #include "dpfs_level.h"
-#include "ivfc_level.h"
+#include "save_headers.h"
 #include "sub_file.h"
 
-std::shared_ptr<FileInterface> MakeDifiFile(std::shared_ptr<FileInterface> header,
-                                            std::shared_ptr<FileInterface> body) {
-    auto difi_header = header->Read(0, 0x44);
-    assert(Pop<u32>(difi_header) == 0x49464944);
-    assert(Pop<u32>(difi_header) == 0x00010000);
-    u64 ivfc_desc_offset = Pop<u64>(difi_header);
-    u64 ivfc_desc_size = Pop<u64>(difi_header);
-    u64 dpfs_desc_offset = Pop<u64>(difi_header);
-    u64 dpfs_desc_size = Pop<u64>(difi_header);
-    u64 main_hash_offset = Pop<u64>(difi_header);
-    u64 main_hash_size = Pop<u64>(difi_header);
-    u8 external_ivfc_l4 = Pop<u8>(difi_header);
-    assert(external_ivfc_l4 < 2);
-    u8 dpfs_selector = Pop<u8>(difi_header);
-    assert(dpfs_selector < 2);
-    assert(Pop<u16>(difi_header) == 0);
-    u64 ivfc_l4_offset = Pop<u64>(difi_header);
-    assert(difi_header.size() == 0);
+std::shared_ptr<IvfcLevel> MakeIvfcLevel(std::shared_ptr<FileInterface> hash,
+                                         std::shared_ptr<FileInterface> body,
+                                         std::size_t block_size, const std::string& label,
+                                         const DisaOptions& options) {
+    auto level = std::make_shared<IvfcLevel>(std::move(hash), std::move(body), block_size);
+    options.Attach(*level, label);
+    if (options.verify_cache) {
+        level->SetVerifiedBlocks(options.verify_cache->GetLevel(label, level->GetBlockCount()));
+    }
+    return level;
+}
+
+std::shared_ptr<FileInterface> MakeDifiFile(
+    std::shared_ptr<FileInterface> header, std::shared_ptr<FileInterface> body,
+    const std::string& name, const DisaOptions& options,
+    std::vector<std::shared_ptr<IvfcLevel>>* ivfc_levels) {
+    auto difi = Decode<DifiHeader>(header->Read(0, sizeof(DifiHeader)));
+    assert(difi.magic == DifiHeader::Magic);
+    assert(difi.version == DifiHeader::Version);
+    assert(difi.external_ivfc_l4 < 2);
+    assert(difi.dpfs_selector < 2);
+    assert(difi.padding == 0);
+
+    auto dpfs = Decode<DpfsDescriptor>(header->Read(difi.dpfs_desc.offset, sizeof(DpfsDescriptor)));
+    assert(dpfs.magic == DpfsDescriptor::Magic);
+    assert(dpfs.version == DpfsDescriptor::Version);
+    const auto& dpfs_l1_desc = dpfs.levels[0];
+    auto dpfs_l1 = std::make_shared<SubFile>(
+        body, dpfs_l1_desc.offset + dpfs_l1_desc.size * difi.dpfs_selector, dpfs_l1_desc.size);
+    options.Attach(*dpfs_l1, name + "/dpfs_l1");
+    std::shared_ptr<FileInterface> dpfs_level = std::move(dpfs_l1);
+    for (int i = 1; i < 3; ++i) {
+        const auto& desc = dpfs.levels[i];
+        auto level = std::make_shared<DpfsLevel>(std::move(dpfs_level),
+                                                 MakeSubFile(body, desc.offset, desc.size * 2),
+                                                 (std::size_t)1 << desc.log2_block_size);
+        options.Attach(*level, name + "/dpfs_l" + std::to_string(i + 1));
+        dpfs_level = std::move(level);
+    }
 
-    auto dpfs_desc = header->Read(dpfs_desc_offset, dpfs_desc_size);
-    assert(Pop<u32>(dpfs_desc) == 0x53465044);
-    assert(Pop<u32>(dpfs_desc) == 0x00010000);
-    u64 dpfs_l1_offset = Pop<u64>(dpfs_desc);
-    u64 dpfs_l1_size = Pop<u64>(dpfs_desc);
-    auto dpfs_l1 = std::make_shared<SubFile>(body, dpfs_l1_offset + dpfs_l1_size * dpfs_selector,
-                                             dpfs_l1_size);
-    Pop<u64>(dpfs_desc); // l1 block_size
-    u64 dpfs_l2_offset = Pop<u64>(dpfs_desc);
-    u64 dpfs_l2_size = Pop<u64>(dpfs_desc);
-    u64 dpfs_l2_block_size = 1 << Pop<u64>(dpfs_desc);
-    auto dpfs_l2 = std::make_shared<DpfsLevel>(
-        std::move(dpfs_l1), std::make_shared<SubFile>(body, dpfs_l2_offset, dpfs_l2_size * 2),
-        dpfs_l2_block_size);
-    u64 dpfs_l3_offset = Pop<u64>(dpfs_desc);
-    u64 dpfs_l3_size = Pop<u64>(dpfs_desc);
-    u64 dpfs_l3_block_size = 1 << Pop<u64>(dpfs_desc);
-    auto dpfs_l3 = std::make_shared<DpfsLevel>(
-        std::move(dpfs_l2), std::make_shared<SubFile>(body, dpfs_l3_offset, dpfs_l3_size * 2),
-        dpfs_l3_block_size);
+    auto ivfc = Decode<IvfcDescriptor>(header->Read(difi.ivfc_desc.offset, sizeof(IvfcDescriptor)));
+    assert(ivfc.magic == IvfcDescriptor::Magic);
+    assert(ivfc.version == IvfcDescriptor::Version);
+    assert(ivfc.master_hash_size == difi.master_hash.size);
+    std::shared_ptr<FileInterface> hash =
+        MakeSubFile(header, difi.master_hash.offset, difi.master_hash.size);
+    std::shared_ptr<IvfcLevel> level;
+    for (int i = 0; i < 4; ++i) {
+        const auto& desc = ivfc.levels[i];
+        auto level_body = i == 3 && difi.external_ivfc_l4
+                              ? MakeSubFile(body, difi.ivfc_l4_offset, desc.size)
+                              : MakeSubFile(dpfs_level, desc.offset, desc.size);
+        level = MakeIvfcLevel(std::move(hash), std::move(level_body),
+                              (std::size_t)1 << desc.log2_block_size,
+                              name + "/ivfc_l" + std::to_string(i + 1), options);
+        if (ivfc_levels)
+            ivfc_levels->push_back(level);
+        hash = level;
+    }
+    if (!options.cache)
+        return level;
 
-    auto ivfc_l0 = std::make_shared<SubFile>(header, main_hash_offset, main_hash_size);
-    auto ivfc_desc = header->Read(ivfc_desc_offset, ivfc_desc_size);
-    assert(Pop<u32>(ivfc_desc) == 0x43465649);
-    assert(Pop<u32>(ivfc_desc) == 0x00020000);
-    assert(Pop<u64>(ivfc_desc) == main_hash_size);
-    u64 ivfc_l1_offset = Pop<u64>(ivfc_desc);
-    u64 ivfc_l1_size = Pop<u64>(ivfc_desc);
-    u64 ivfc_l1_block_size = 1 << Pop<u64>(ivfc_desc);
-    auto ivfc_l1 = std::make_shared<IvfcLevel>(
-        std::move(ivfc_l0), std::make_shared<SubFile>(dpfs_l3, ivfc_l1_offset, ivfc_l1_size),
-        ivfc_l1_block_size);
-    u64 ivfc_l2_offset = Pop<u64>(ivfc_desc);
-    u64 ivfc_l2_size = Pop<u64>(ivfc_desc);
-    u64 ivfc_l2_block_size = 1 << Pop<u64>(ivfc_desc);
-    auto ivfc_l2 = std::make_shared<IvfcLevel>(
-        std::move(ivfc_l1), std::make_shared<SubFile>(dpfs_l3, ivfc_l2_offset, ivfc_l2_size),
-        ivfc_l2_block_size);
-    u64 ivfc_l3_offset = Pop<u64>(ivfc_desc);
-    u64 ivfc_l3_size = Pop<u64>(ivfc_desc);
-    u64 ivfc_l3_block_size = 1 << Pop<u64>(ivfc_desc);
-    auto ivfc_l3 = std::make_shared<IvfcLevel>(
-        std::move(ivfc_l2), std::make_shared<SubFile>(dpfs_l3, ivfc_l3_offset, ivfc_l3_size),
-        ivfc_l3_block_size);
-    u64 inner_ivfc_l4_offset = Pop<u64>(ivfc_desc);
-    u64 ivfc_l4_size = Pop<u64>(ivfc_desc);
-    u64 ivfc_l4_block_size = 1 << Pop<u64>(ivfc_desc);
-    auto ivfc_l4 = std::make_shared<IvfcLevel>(
-        std::move(ivfc_l3),
-        external_ivfc_l4 ? std::make_shared<SubFile>(body, ivfc_l4_offset, ivfc_l4_size)
-                         : std::make_shared<SubFile>(dpfs_l3, inner_ivfc_l4_offset, ivfc_l4_size),
-        ivfc_l4_block_size);
-    return ivfc_l4;
+    // Reading a cached block again skips the hashing and everything below level 4.
+    auto cache = std::make_shared<BlockCache>(
+        level, (std::size_t)1 << ivfc.levels[3].log2_block_size, options.cache);
+    options.Attach(*cache, name + "/cache");
+    return cache;
 }
@@ -1,7 +1,22 @@
 #pragma once
 
 #include <memory>
+#include <string>
+#include <vector>
 #include "file_interface.h"
+#include "ivfc_level.h"
 
-std::shared_ptr<FileInterface> MakeDifiFile(std::shared_ptr<FileInterface> header,
-                                            std::shared_ptr<FileInterface> body);
+struct DisaOptions;
+
+// `name` labels the partition's layers, e.g. "save" gives "save/ivfc_l4". The IVFC levels, from
+// level 1 to level 4, are appended to `ivfc_levels` if given. With `options.cache`, level 4 is
+// read through a BlockCache.
+std::shared_ptr<FileInterface> MakeDifiFile(
+    std::shared_ptr<FileInterface> header, std::shared_ptr<FileInterface> body,
+    const std::string& name, const DisaOptions& options,
+    std::vector<std::shared_ptr<IvfcLevel>>* ivfc_levels = nullptr);
+
+std::shared_ptr<IvfcLevel> MakeIvfcLevel(std::shared_ptr<FileInterface> hash,
+                                         std::shared_ptr<FileInterface> body,
+                                         std::size_t block_size, const std::string& label,
+                                         const DisaOptions& options);
@@ -1,14 +1,21 @@
 #include <cstdio>
 #include <cstring>
 #include <functional>
+#include <iterator>
+#include <map>
 #include "alignment.h"
 #include "crypto.h"
 #include "difi.h"
 #include "disa.h"
-#include "ivfc_level.h"
 #include "metadata_table.h"
+#include "save_headers.h"
 #include "sub_file.h"
 
+void DisaOptions::Attach(FileInterface& layer, const std::string& label) const {
+    if (stats)
+        stats->Attach(layer, label_prefix + label);
+}
+
 class DisaFile : public FsFileInterface {
 public:
     DisaFile(u64 size, u32 block_index, std::function<void(u64, u32)> close_callback, Fat* fat,
@@ -27,16 +34,36 @@ public:
         std::size_t cur = offset;
 
         while (cur < end) {
-            std::size_t block_low = AlignDown(cur, block_size);
-            std::size_t offset_in_block = cur - block_low;
-            std::size_t block_up = std::min(block_low + block_size, end);
-            std::size_t size_in_block = block_up - cur;
+            auto next_range = write_buffer.upper_bound(cur);
+            if (next_range != write_buffer.begin()) {
+                auto range = std::prev(next_range);
+                std::size_t range_end = range->first + range->second.size();
+                if (range_end > cur) {
+                    std::size_t copy_end = std::min(range_end, end);
+                    std::memcpy(buf, range->second.data() + (cur - range->first), copy_end - cur);
+                    buf += copy_end - cur;
+                    cur = copy_end;
+                    continue;
+                }
+            }
+
+            // Read up to the next buffered range, over FAT blocks that are also adjacent in the
+            // data region, straight into `buf`.
+            std::size_t read_end = end;
+            if (next_range != write_buffer.end())
+                read_end = std::min<std::size_t>(read_end, next_range->first);
+            std::size_t block = cur / block_size;
             std::size_t data_region_offset =
-                chain[block_low / block_size].block_index * block_size + offset_in_block;
-            auto data = data_image->Read(data_region_offset, size_in_block);
-            std::memcpy(buf, data.data(), size_in_block);
-            buf += size_in_block;
-            cur = block_up;
+                chain[block].block_index * block_size + (cur - block * block_size);
+            std::size_t run_end = std::min((block + 1) * block_size, read_end);
+            while (run_end < read_end &&
+                   chain[block + 1].block_index == chain[block].block_index + 1) {
+                ++block;
+                run_end = std::min((block + 1) * block_size, read_end);
+            }
+            data_image->Read(data_region_offset, run_end - cur, buf);
+            buf += run_end - cur;
+            cur = run_end;
         }
 
         return end - offset;
@@ -57,26 +84,14 @@ public:
             }
             assert(chain.size() == new_block_size);
             file_size = end;
-        }
 
-        auto other = fat->GetChain(block_index);
-        assert(other == chain);
-
-        std::size_t cur = offset;
-
-        while (cur < end) {
-            std::size_t block_low = AlignDown(cur, block_size);
-            std::size_t offset_in_block = cur - block_low;
-            std::size_t block_up = std::min(block_low + block_size, end);
-            std::size_t size_in_block = block_up - cur;
-            std::size_t data_region_offset =
-                chain[block_low / block_size].block_index * block_size + offset_in_block;
-            bytes data(size_in_block);
-            std::memcpy(data.data(), buf, size_in_block);
-            data_image->Write(data_region_offset, data);
-            buf += size_in_block;
-            cur = block_up;
+            auto other = fat->GetChain(block_index);
+            assert(other == chain);
         }
+
+        BufferWrite(offset, size, buf);
+        if (buffered_size > WriteBufferLimit)
+            Flush();
         return origin_size;
     }
     std::size_t GetSize() override {
@@ -85,6 +100,37 @@ public:
     std::size_t SetSize(std::size_t size) override {
         assert(false);
     }
+    void Flush() override {
+        // A range ending at the end of the file is padded out to the end of its FAT block, so
+        // that the last block is written whole instead of being read back and merged below.
+        if (!write_buffer.empty()) {
+            auto& last = *write_buffer.rbegin();
+            if (last.first + last.second.size() == file_size)
+                last.second.resize(AlignUp(file_size, block_size) - last.first, 0);
+        }
+        for (const auto& range : write_buffer) {
+            std::size_t cur = range.first;
+            std::size_t end = range.first + range.second.size();
+            while (cur < end) {
+                // Extend the run over FAT blocks that are also adjacent in the data region, so
+                // that each run goes down the stack in a single write.
+                std::size_t block = cur / block_size;
+                std::size_t data_region_offset =
+                    chain[block].block_index * block_size + (cur - block * block_size);
+                std::size_t run_end = std::min((block + 1) * block_size, end);
+                while (run_end < end &&
+                       chain[block + 1].block_index == chain[block].block_index + 1) {
+                    ++block;
+                    run_end = std::min((block + 1) * block_size, end);
+                }
+                data_image->Write(data_region_offset, run_end - cur,
+                                  range.second.data() + (cur - range.first));
+                cur = run_end;
+            }
+        }
+        write_buffer.clear();
+        buffered_size = 0;
+    }
     void Close() override {
         --ref_count;
         if (ref_count == 0) {
@@ -93,6 +139,7 @@ public:
                     fat->FreeChain(block_index);
                 }
             } else {
+                Flush();
                 close_callback(file_size, block_index);
             }
             delete this;
@@ -104,9 +151,52 @@ public:
     void Detach() {
         detached = true;
         close_callback = {};
+        write_buffer.clear();
+        buffered_size = 0;
     }
 
 private:
+    static constexpr std::size_t WriteBufferLimit = 0x100000;
+
+    // Merges [offset, offset + size) into write_buffer, coalescing it with every buffered range
+    // it overlaps or touches.
+    void BufferWrite(std::size_t offset, std::size_t size, const u8* buf) {
+        std::size_t begin = offset;
+        std::size_t end = offset + size;
+        auto first = write_buffer.upper_bound(offset);
+        if (first != write_buffer.begin()) {
+            auto prev = std::prev(first);
+            if (prev->first + prev->second.size() >= offset)
+                first = prev;
+        }
+        auto last = first;
+        for (; last != write_buffer.end() && last->first <= end; ++last) {
+            begin = std::min<std::size_t>(begin, last->first);
+            end = std::max<std::size_t>(end, last->first + last->second.size());
+        }
+
+        // A write that only touches one range starting at or before it extends that range in
+        // place, so that a file written front to back is not copied again on every write.
+        if (first != last && std::next(first) == last && first->first == begin) {
+            bytes& range = first->second;
+            buffered_size += (end - begin) - range.size();
+            range.resize(end - begin);
+            std::memcpy(range.data() + (offset - begin), buf, size);
+            return;
+        }
+
+        bytes merged(end - begin);
+        for (auto range = first; range != last; ++range) {
+            std::memcpy(merged.data() + (range->first - begin), range->second.data(),
+                        range->second.size());
+            buffered_size -= range->second.size();
+        }
+        std::memcpy(merged.data() + (offset - begin), buf, size);
+        write_buffer.erase(first, last);
+        buffered_size += merged.size();
+        write_buffer.emplace(begin, std::move(merged));
+    }
+
     bool detached = false;
     unsigned ref_count = 1;
     u64 file_size;
@@ -116,120 +206,94 @@ private:
     std::vector<BlockMap> chain;
     FileInterface* data_image;
     u32 block_size;
+    std::map<std::size_t, bytes> write_buffer;
+    std::size_t buffered_size = 0;
 };
 
 Disa::Disa(std::shared_ptr<FileInterface> container,
-           std::unique_ptr<AesCmacBlockProvider> block_provider, const bytes& key) {
+           std::unique_ptr<AesCmacBlockProvider> block_provider, const bytes& key,
+           const DisaOptions& options) {
 
     std::shared_ptr<FileInterface> header_file = std::make_shared<SubFile>(container, 0x100, 0x100);
     if (block_provider) {
-        auto signature = std::make_shared<SubFile>(container, 0x0, 0x10);
-        header_file =
-            std::make_shared<AesCmacSigned>(signature, header_file, key, std::move(block_provider));
+        auto signature = MakeSubFile(container, 0x0, 0x10);
+        bool verified = options.verify_cache && options.verify_cache->IsHeaderVerified();
+        auto signed_header = std::make_shared<AesCmacSigned>(
+            signature, header_file, key, std::move(block_provider), verified, options.lazy);
+        if (options.verify_cache && signed_header->IsVerified())
+            options.verify_cache->SetHeaderVerified();
+        header_file = std::move(signed_header);
     }
-    auto header = header_file->Read(0, 0x6C);
-    assert(Pop<u32>(header) == 0x41534944);
-    assert(Pop<u32>(header) == 0x00040000);
-    u64 partition_count = Pop<u64>(header);
+    options.Attach(*header_file, "header");
+    auto header = Decode<DisaHeader>(header_file->Read(0, sizeof(DisaHeader)));
+    assert(header.magic == DisaHeader::Magic);
+    assert(header.version == DisaHeader::Version);
+    u64 partition_count = header.partition_count;
     assert(partition_count == 1 || partition_count == 2);
-    u64 table_sec_offset = Pop<u64>(header);
-    u64 table_pri_offset = Pop<u64>(header);
-    u64 table_size = Pop<u64>(header);
-    u64 save_entry_offset = Pop<u64>(header);
-    u64 save_entry_size = Pop<u64>(header);
-    u64 data_entry_offset = Pop<u64>(header);
-    u64 data_entry_size = Pop<u64>(header);
-    u64 save_offset = Pop<u64>(header);
-    u64 save_size = Pop<u64>(header);
-    u64 data_offset = Pop<u64>(header);
-    u64 data_size = Pop<u64>(header);
-    u8 active_table = Pop<u8>(header);
-    assert(active_table < 2);
-    u64 table_offset = active_table ? table_sec_offset : table_pri_offset;
-    Pop<u8>(header);
-    Pop<u8>(header);
-    Pop<u8>(header);
-    assert(header.empty());
-
-    auto table = std::make_shared<IvfcLevel>(
-        std::make_shared<SubFile>(header_file, 0x06C, 0x20),
-        std::make_shared<SubFile>(container, table_offset, table_size), table_size);
-
-    auto save_difi_header = std::make_shared<SubFile>(table, save_entry_offset, save_entry_size);
-    auto save_body = std::make_shared<SubFile>(container, save_offset, save_size);
-    part_save = MakeDifiFile(save_difi_header, save_body);
-
-    if (partition_count == 2) {
-        auto data_difi_header =
-            std::make_shared<SubFile>(table, data_entry_offset, data_entry_size);
-        auto data_body = std::make_shared<SubFile>(container, data_offset, data_size);
-        part_data = MakeDifiFile(data_difi_header, data_body);
-    }
+    assert(header.active_table < 2);
+    u64 table_offset = header.active_table ? header.table_sec_offset : header.table_pri_offset;
+    u64 table_size = header.table_size;
 
-    auto save_header = part_save->Read(0, 0x88);
-
-    assert(Pop<u32>(save_header) == 0x45564153);
-    assert(Pop<u32>(save_header) == 0x00040000);
-    Pop<u64>(save_header);
-    Pop<u64>(save_header);
-    Pop<u64>(save_header);
-    Pop<u32>(save_header);
-    block_size = Pop<u32>(save_header);
-
-    u64 dir_hash_offset = Pop<u64>(save_header);
-    u32 dir_bucket = Pop<u32>(save_header);
-    Pop<u32>(save_header);
-
-    u64 file_hash_offset = Pop<u64>(save_header);
-    u32 file_bucket = Pop<u32>(save_header);
-    Pop<u32>(save_header);
-
-    u64 fat_offset = Pop<u64>(save_header);
-    u32 fat_size = Pop<u32>(save_header);
-    Pop<u32>(save_header);
-    fat =
-        std::make_unique<Fat>(std::make_shared<SubFile>(part_save, fat_offset, (fat_size + 1) * 8));
-
-    u64 data_region_offset = Pop<u64>(save_header);
-    u32 data_block_count = Pop<u32>(save_header);
-    assert(data_block_count == fat_size);
-    Pop<u32>(save_header);
-
-    if (partition_count == 1) {
-        part_data =
-            std::make_shared<SubFile>(part_save, data_region_offset, data_block_count * block_size);
-    }
+    auto table = MakeIvfcLevel(std::make_shared<SubFile>(header_file, sizeof(DisaHeader), 0x20),
+                               MakeSubFile(container, table_offset, table_size),
+                               table_size, "table", options);
 
-    u64 dir_offset;
-    if (partition_count == 2) {
-        dir_offset = Pop<u64>(save_header);
-    } else {
-        u32 block_index = Pop<u32>(save_header);
-        /*u32 block_count =*/Pop<u32>(save_header);
-        dir_offset = block_index * block_size + data_region_offset;
-    }
-    u32 dir_size = Pop<u32>(save_header) + 2;
-    Pop<u32>(save_header);
+    const ByteRange& save_entry = header.partition_entry[0];
+    const ByteRange& save_range = header.partition[0];
+    auto save_difi_header = MakeSubFile(table, save_entry.offset, save_entry.size);
+    auto save_body = MakeSubFile(container, save_range.offset, save_range.size);
+    part_save = MakeDifiFile(save_difi_header, save_body, "save", options, &ivfc_levels);
 
-    u64 file_offset;
-    if (partition_count == 2) {
-        file_offset = Pop<u64>(save_header);
-    } else {
-        u32 block_index = Pop<u32>(save_header);
-        /*u32 block_count =*/Pop<u32>(save_header);
-        file_offset = block_index * block_size + data_region_offset;
-    }
-    u32 file_size = Pop<u32>(save_header) + 1;
-    Pop<u32>(save_header);
+    auto save_header = Decode<SaveHeader>(part_save->Read(0, sizeof(SaveHeader)));
+    assert(save_header.magic == SaveHeader::Magic);
+    assert(save_header.version == SaveHeader::Version);
+    block_size = save_header.block_size;
+    assert(save_header.data_block_count == save_header.fat_size);
+
+    data_loader = [=]() {
+        auto fat_table = std::make_shared<SubFile>(part_save, save_header.fat_offset,
+                                                   (save_header.fat_size + 1) * 8);
+        options.Attach(*fat_table, "fs/fat");
+        fat = std::make_unique<Fat>(fat_table);
 
-    auto dir_hash = std::make_shared<SubFile>(part_save, dir_hash_offset, dir_bucket * 4);
-    auto file_hash = std::make_shared<SubFile>(part_save, file_hash_offset, file_bucket * 4);
+        if (partition_count == 2) {
+            const ByteRange& data_entry = header.partition_entry[1];
+            const ByteRange& data_range = header.partition[1];
+            auto data_difi_header = MakeSubFile(table, data_entry.offset, data_entry.size);
+            auto data_body = MakeSubFile(container, data_range.offset, data_range.size);
+            part_data =
+                MakeDifiFile(data_difi_header, data_body, "data", options, &ivfc_levels);
+        } else {
+            part_data = std::make_shared<SubFile>(part_save, save_header.data_region_offset,
+                                                  save_header.data_block_count * block_size);
+            options.Attach(*part_data, "fs/data");
+        }
+    };
+    if (!options.lazy)
+        LoadData();
+
+    auto table_offset_of = [&](const TableLocation& location) -> u64 {
+        if (partition_count == 2)
+            return location.offset;
+        return location.chain.start_block * block_size + save_header.data_region_offset;
+    };
+    u64 dir_offset = table_offset_of(save_header.dir_table);
+    u32 dir_size = save_header.max_dirs + 2;
+    u64 file_offset = table_offset_of(save_header.file_table);
+    u32 file_size = save_header.max_files + 1;
+
+    auto dir_hash = std::make_shared<SubFile>(part_save, save_header.dir_hash_offset,
+                                              save_header.dir_buckets * 4);
+    auto file_hash = std::make_shared<SubFile>(part_save, save_header.file_hash_offset,
+                                               save_header.file_buckets * 4);
     auto dir_table = std::make_shared<SubFile>(part_save, dir_offset, dir_size * 0x28);
     auto file_table = std::make_shared<SubFile>(part_save, file_offset, file_size * 0x30);
+    options.Attach(*dir_hash, "fs/dir_hash");
+    options.Attach(*file_hash, "fs/file_hash");
+    options.Attach(*dir_table, "fs/dir_table");
+    options.Attach(*file_table, "fs/file_table");
 
     meta = std::make_unique<FsMetadata>(dir_table, dir_hash, file_table, file_hash);
-
-    assert(save_header.empty());
 }
 
 FsStat Disa::Find(const char* path) {
@@ -252,6 +316,7 @@ void Disa::RemoveFile(u32 index) {
     } else {
         u32 block_index = meta->GetFileBlockIndex(index);
         if (block_index != 0x80000000) {
+            LoadData();
             fat->FreeChain(block_index);
         }
     }
@@ -283,6 +348,7 @@ FsFileInterface* Disa::Open(u32 index) {
         return opened_file->second;
     }
 
+    LoadData();
     DisaFile* new_file = new DisaFile(meta->GetFileSize(index), meta->GetFileBlockIndex(index),
                                       [index, this](u32 size, u64 block_index) {
                                           meta->SetFileSize(index, size);
@@ -293,3 +359,45 @@ FsFileInterface* Disa::Open(u32 index) {
     opened_files[index] = new_file;
     return new_file;
 }
+
+u32 Disa::GetBlockSize() const {
+    return block_size;
+}
+
+u64 Disa::CountBlocks(u64 size) const {
+    return AlignUp(size, block_size) / block_size;
+}
+
+u32 Disa::GetFreeBlockCount() {
+    LoadData();
+    return fat->GetFreeBlockCount();
+}
+
+u32 Disa::GetFreeDirCount() {
+    return meta->GetFreeDirCount();
+}
+
+u32 Disa::GetFreeFileCount() {
+    return meta->GetFreeFileCount();
+}
+
+void Disa::BeginBatch() {
+    LoadData();
+    for (const auto& level : ivfc_levels)
+        level->BeginDeferredHashing();
+}
+
+void Disa::CommitBatch() {
+    for (const auto& file : opened_files)
+        file.second->Flush();
+    // Each level's hashes are written to the level above it, so hash from level 4 upwards.
+    for (auto level = ivfc_levels.rbegin(); level != ivfc_levels.rend(); ++level)
+        (*level)->EndDeferredHashing();
+}
+
+void Disa::LoadData() {
+    if (data_loader) {
+        data_loader();
+        data_loader = nullptr;
+    }
+}
@@ -1,18 +1,44 @@
 #pragma once
 
+#include <functional>
 #include <memory>
+#include <string>
 #include <unordered_map>
 #include "aes_cmac.h"
+#include "block_cache.h"
 #include "fat.h"
 #include "file_interface.h"
+#include "ivfc_level.h"
 #include "metadata_table.h"
+#include "stats.h"
+#include "verify_cache.h"
 
 class DisaFile;
 
+struct DisaOptions {
+    std::shared_ptr<VerifyCache> verify_cache;
+
+    // Keeps verified blocks of each partition in RAM, within a budget that may be shared with
+    // other images.
+    std::shared_ptr<CacheBudget> cache;
+
+    // Defer building the FAT and the data partition until a file is first opened, and checking
+    // the header CMAC until the first write.
+    bool lazy = false;
+
+    std::shared_ptr<StatsRegistry> stats;
+    // Put in front of every label in `stats`, to tell the layers of several images apart.
+    std::string label_prefix;
+
+    // Labels `layer` in `stats`, if any.
+    void Attach(FileInterface& layer, const std::string& label) const;
+};
+
 class Disa : public FsInterface {
 public:
     Disa(std::shared_ptr<FileInterface> container,
-         std::unique_ptr<AesCmacBlockProvider> block_provider = nullptr, const bytes& key = {});
+         std::unique_ptr<AesCmacBlockProvider> block_provider = nullptr, const bytes& key = {},
+         const DisaOptions& options = {});
 
     FsStat Find(const char* path) override;
     u32 MakeDir(const FsName& name, u32 parent) override;
@@ -26,10 +52,30 @@ public:
     u64 GetFileSize(u32 index) override;
     FsFileInterface* Open(u32 index) override;
 
+    // A file of `size` bytes takes CountBlocks(size) blocks of GetBlockSize() bytes in the data
+    // region, out of GetFreeBlockCount() free ones.
+    u32 GetBlockSize() const;
+    u64 CountBlocks(u64 size) const;
+    u32 GetFreeBlockCount();
+    // Directories and files that can still be created.
+    u32 GetFreeDirCount();
+    u32 GetFreeFileCount();
+
+    // Between these calls, IVFC hashes are not updated on write. CommitBatch() flushes open files
+    // and then hashes every written block once per level, so a bulk import hashes and signs the
+    // tree once instead of once per write.
+    void BeginBatch();
+    void CommitBatch();
+
 private:
     std::shared_ptr<FileInterface> part_save, part_data;
     std::unique_ptr<Fat> fat;
     u32 block_size;
     std::unique_ptr<FsMetadata> meta;
     std::unordered_map<u32, DisaFile*> opened_files;
+    // Level 1 to 4 of the save partition, then of the data partition if any.
+    std::vector<std::shared_ptr<IvfcLevel>> ivfc_levels;
+
+    std::function<void()> data_loader;
+    void LoadData();
 };
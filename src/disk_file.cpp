@@ -6,7 +6,7 @@
 #define safe_fseek std::fseek
 #define safe_ftell std::ftell
 
-class DiskFile : public FileInterface {
+class DiskFile final : public FileInterface {
 public:
     DiskFile(std::FILE* handle_, std::size_t file_size_)
         : FileInterface(file_size_), handle(handle_) {}
@@ -16,16 +16,14 @@ public:
     }
 
 protected:
-    bytes ReadImpl(std::size_t offset, std::size_t size) override {
+    void ReadIntoImpl(std::size_t offset, std::size_t size, u8* dst) override {
         safe_fseek(handle, offset, SEEK_SET);
-        bytes result(size);
-        assert(std::fread(result.data(), size, 1, handle) == 1);
-        return result;
+        assert(std::fread(dst, size, 1, handle) == 1);
     }
 
-    void WriteImpl(std::size_t offset, const bytes& data) override {
+    void WriteFromImpl(std::size_t offset, std::size_t size, const u8* src) override {
         safe_fseek(handle, offset, SEEK_SET);
-        assert(std::fwrite(data.data(), data.size(), 1, handle) == 1);
+        assert(std::fwrite(src, size, 1, handle) == 1);
         std::fflush(handle);
     }
 
@@ -34,8 +32,15 @@ private:
 };
 
 std::shared_ptr<FileInterface> OpenDiskFile(const char* path) {
+    auto file = TryOpenDiskFile(path);
+    assert(file);
+    return file;
+}
+
+std::shared_ptr<FileInterface> TryOpenDiskFile(const char* path) {
     std::FILE* handle = std::fopen(path, "r+b");
-    assert(handle);
+    if (!handle)
+        return nullptr;
 
     // FIXME
     safe_fseek(handle, 0, SEEK_END);
@@ -44,3 +49,16 @@ std::shared_ptr<FileInterface> OpenDiskFile(const char* path) {
 
     return std::make_shared<DiskFile>(handle, size);
 }
+
+std::shared_ptr<FileInterface> CreateDiskFile(const char* path, std::size_t size) {
+    std::FILE* handle = std::fopen(path, "w+b");
+    assert(handle);
+
+    if (size != 0) {
+        safe_fseek(handle, size - 1, SEEK_SET);
+        assert(std::fputc(0, handle) == 0);
+        std::fflush(handle);
+    }
+
+    return std::make_shared<DiskFile>(handle, size);
+}
@@ -4,3 +4,9 @@
 #include "file_interface.h"
 
 std::shared_ptr<FileInterface> OpenDiskFile(const char* path);
+
+// Like OpenDiskFile, but returns nullptr if `path` cannot be opened for reading and writing.
+std::shared_ptr<FileInterface> TryOpenDiskFile(const char* path);
+
+// Creates, or truncates, the file at `path` to `size` zero bytes.
+std::shared_ptr<FileInterface> CreateDiskFile(const char* path, std::size_t size);
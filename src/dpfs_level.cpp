@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <vector>
 #include "dpfs_level.h"
 
 DpfsLevel::DpfsLevel(std::shared_ptr<FileInterface> selector_, std::shared_ptr<FileInterface> pair_,
@@ -5,26 +7,58 @@ DpfsLevel::DpfsLevel(std::shared_ptr<FileInterface> selector_, std::shared_ptr<F
     : BlockFile(pair_->file_size / 2, block_size_), selector(std::move(selector_)),
       pair(std::move(pair_)) {}
 
+template <typename Func>
+void DpfsLevel::ForEachRun(std::size_t first, std::size_t count, Func func) {
+    // The selector words covering the range, read at once. Short ranges fit in `local`.
+    std::size_t first_u32 = first / 32;
+    std::size_t u32_count = (first + count + 31) / 32 - first_u32;
+    u32 local[16];
+    std::vector<u32> large;
+    u32* groups = local;
+    if (u32_count > 16) {
+        large.resize(u32_count);
+        groups = large.data();
+    }
+    selector->Read(first_u32 * 4, u32_count * 4, reinterpret_cast<u8*>(groups));
+    auto selected = [&](std::size_t block) {
+        std::size_t index = block - first_u32 * 32;
+        return (groups[index / 32] >> (31 - index % 32)) & 1;
+    };
+
+    std::size_t i = first;
+    while (i < first + count) {
+        u32 bit = selected(i);
+        std::size_t j = i + 1;
+        while (j < first + count && selected(j) == bit)
+            ++j;
+        std::size_t offset = i * block_size;
+        std::size_t end = std::min(j * block_size, file_size);
+        if (offset < end)
+            func(offset, end, bit ? file_size : 0);
+        i = j;
+    }
+}
+
 bytes DpfsLevel::ReadBlock(std::size_t block_index) {
-    std::size_t offset = block_index * block_size;
-    std::size_t upper = offset + block_size;
-    std::size_t end = std::min(upper, file_size);
-    auto result = pair->Read(offset + Select(block_index), end - offset);
-    result += bytes(upper - end, 0);
+    bytes result(block_size);
+    ReadBlocks(block_index, 1, result.data());
     return result;
 }
 
 void DpfsLevel::WriteBlock(std::size_t block_index, const bytes& data) {
-    std::size_t offset = block_index * block_size;
-    std::size_t upper = offset + block_size;
-    std::size_t end = std::min(upper, file_size);
-    auto buffer = bytes(data.begin(), data.begin() + (end - offset));
-    pair->Write(offset + Select(block_index), buffer);
+    WriteBlocks(block_index, 1, data.data());
+}
+
+void DpfsLevel::ReadBlocks(std::size_t first, std::size_t count, u8* dst) {
+    ForEachRun(first, count, [&](std::size_t offset, std::size_t end, std::size_t base) {
+        pair->Read(offset + base, end - offset, dst + (offset - first * block_size));
+    });
+    std::size_t end = std::min((first + count) * block_size, file_size);
+    std::fill(dst + (end - first * block_size), dst + count * block_size, 0);
 }
 
-std::size_t DpfsLevel::Select(std::size_t index) {
-    std::size_t u32_index = index / 32;
-    std::size_t inner_index = index % 32;
-    u32 group = Decode<u32>(selector->Read(u32_index * 4, 4));
-    return ((group >> (31 - inner_index)) & 1) * file_size;
+void DpfsLevel::WriteBlocks(std::size_t first, std::size_t count, const u8* src) {
+    ForEachRun(first, count, [&](std::size_t offset, std::size_t end, std::size_t base) {
+        pair->Write(offset + base, end - offset, src + (offset - first * block_size));
+    });
 }
@@ -3,7 +3,7 @@
 #include <memory>
 #include "block_file.h"
 
-class DpfsLevel : public BlockFile {
+class DpfsLevel final : public BlockFile {
 public:
     DpfsLevel(std::shared_ptr<FileInterface> selector_, std::shared_ptr<FileInterface> pair_,
               std::size_t block_size_);
@@ -11,9 +11,15 @@ public:
 protected:
     bytes ReadBlock(std::size_t block_index) override;
     void WriteBlock(std::size_t block_index, const bytes& data) override;
+    void ReadBlocks(std::size_t first, std::size_t count, u8* dst) override;
+    void WriteBlocks(std::size_t first, std::size_t count, const u8* src) override;
 
 private:
     std::shared_ptr<FileInterface> selector;
     std::shared_ptr<FileInterface> pair;
-    std::size_t Select(size_t index);
+    // Calls `func(offset, end, base)` for each run of blocks in [first, first + count) with the
+    // same selector bit, where [offset, end) is the run clipped to the level and `base` is the
+    // offset of the selected copy.
+    template <typename Func>
+    void ForEachRun(std::size_t first, std::size_t count, Func func);
 };
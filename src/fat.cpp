@@ -86,12 +86,20 @@ void Fat::ExpandChain(std::vector<BlockMap>& chain, u32 more) {
 
 void Fat::TruncateChain(std::vector<BlockMap>& chain, u32 less) {}
 
+u32 Fat::GetFreeBlockCount() {
+    u32 count = 0;
+    for (u32 index = GetFreeHead(); index != NoIndex; index = GetEntry(index).v)
+        count += GetNode(index).size;
+    return count;
+}
+
 Fat::Entry Fat::GetEntry(u32 block_index) {
     assert(block_index < block_count);
     auto raw = table->Read((block_index + 1) * 8, 8);
+    ByteReader reader(raw);
     Entry result;
-    result.u = Pop<u32>(raw);
-    result.v = Pop<u32>(raw);
+    result.u = reader.Read<u32>();
+    result.v = reader.Read<u32>();
     if (result.u >= 0x80000000) {
         result.u -= 0x80000000;
         result.u_flag = true;
@@ -173,12 +181,15 @@ void Fat::SetFreeHead(u32 head) {
 
 void Fat::AddNodeToFreeChain(u32 block_index) {
     u32 old_head_index = GetFreeHead();
-    auto old_head = GetEntry(old_head_index);
-    assert(old_head.u_flag);
-    assert(old_head.u == NoIndex);
-    old_head.u = block_index;
-    old_head.u_flag = false;
-    SetEntry(old_head_index, old_head);
+    // The free chain is empty when every block is in use.
+    if (old_head_index != NoIndex) {
+        auto old_head = GetEntry(old_head_index);
+        assert(old_head.u_flag);
+        assert(old_head.u == NoIndex);
+        old_head.u = block_index;
+        old_head.u_flag = false;
+        SetEntry(old_head_index, old_head);
+    }
 
     auto new_head = GetEntry(block_index);
     new_head.u_flag = true;
@@ -21,6 +21,7 @@ public:
     void FreeChain(u32 start_index);
     void ExpandChain(std::vector<BlockMap>& chain, u32 more);
     void TruncateChain(std::vector<BlockMap>& chain, u32 less);
+    u32 GetFreeBlockCount();
 
 private:
     u32 block_count;
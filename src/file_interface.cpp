@@ -5,12 +5,62 @@ FileInterface::FileInterface(std::size_t file_size_) : file_size(file_size_) {}
 
 FileInterface::~FileInterface() {}
 
-std::vector<u8> FileInterface::Read(std::size_t offset, std::size_t size) {
+bytes FileInterface::Read(std::size_t offset, std::size_t size) {
     assert(offset + size <= file_size);
-    return ReadImpl(offset, size);
+    if (!stats)
+        return ReadImpl(offset, size);
+    auto start = std::chrono::steady_clock::now();
+    auto result = ReadImpl(offset, size);
+    stats->CountRead(offset, size, start);
+    return result;
 }
 
-void FileInterface::Write(std::size_t offset, const std::vector<u8>& data) {
+void FileInterface::Write(std::size_t offset, const bytes& data) {
     assert(offset + data.size() <= file_size);
+    if (!stats)
+        return WriteImpl(offset, data);
+    auto start = std::chrono::steady_clock::now();
     WriteImpl(offset, data);
+    stats->CountWrite(offset, data.size(), start);
+}
+
+void FileInterface::Read(std::size_t offset, std::size_t size, u8* dst) {
+    assert(offset + size <= file_size);
+    if (!stats)
+        return ReadIntoImpl(offset, size, dst);
+    auto start = std::chrono::steady_clock::now();
+    ReadIntoImpl(offset, size, dst);
+    stats->CountRead(offset, size, start);
+}
+
+void FileInterface::Write(std::size_t offset, std::size_t size, const u8* src) {
+    assert(offset + size <= file_size);
+    if (!stats)
+        return WriteFromImpl(offset, size, src);
+    auto start = std::chrono::steady_clock::now();
+    WriteFromImpl(offset, size, src);
+    stats->CountWrite(offset, size, start);
+}
+
+void FileInterface::SetStats(std::shared_ptr<LayerStats> stats_) {
+    stats = std::move(stats_);
+}
+
+bytes FileInterface::ReadImpl(std::size_t offset, std::size_t size) {
+    bytes result(size);
+    ReadIntoImpl(offset, size, result.data());
+    return result;
+}
+
+void FileInterface::WriteImpl(std::size_t offset, const bytes& data) {
+    WriteFromImpl(offset, data.size(), data.data());
+}
+
+void FileInterface::ReadIntoImpl(std::size_t offset, std::size_t size, u8* dst) {
+    auto data = ReadImpl(offset, size);
+    std::memcpy(dst, data.data(), size);
+}
+
+void FileInterface::WriteFromImpl(std::size_t offset, std::size_t size, const u8* src) {
+    WriteImpl(offset, bytes(src, src + size));
 }
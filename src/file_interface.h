@@ -1,6 +1,8 @@
 #pragma once
 
+#include <memory>
 #include "bytes.h"
+#include "stats.h"
 
 class FileBrancher;
 
@@ -11,9 +13,20 @@ public:
 
     bytes Read(std::size_t offset, std::size_t size);
     void Write(std::size_t offset, const bytes& data);
+    // The same through a caller-provided buffer of `size` bytes, so that data passed down the stack
+    // does not need a new vector at every layer.
+    void Read(std::size_t offset, std::size_t size, u8* dst);
+    void Write(std::size_t offset, std::size_t size, const u8* src);
     const std::size_t file_size;
 
+    void SetStats(std::shared_ptr<LayerStats> stats_);
+
 protected:
-    virtual std::vector<u8> ReadImpl(std::size_t offset, std::size_t size) = 0;
-    virtual void WriteImpl(std::size_t offset, const bytes& data) = 0;
+    // Layers override at least one of each pair; the defaults convert to the other one.
+    virtual bytes ReadImpl(std::size_t offset, std::size_t size);
+    virtual void WriteImpl(std::size_t offset, const bytes& data);
+    virtual void ReadIntoImpl(std::size_t offset, std::size_t size, u8* dst);
+    virtual void WriteFromImpl(std::size_t offset, std::size_t size, const u8* src);
+
+    std::shared_ptr<LayerStats> stats;
 };
@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <cassert>
+#include "alignment.h"
+#include "crypto.h"
+#include "format.h"
+#include "save_headers.h"
+
+static void Place(bytes& out, std::size_t offset, const bytes& data) {
+    assert(offset + data.size() <= out.size());
+    std::copy(data.begin(), data.end(), out.begin() + offset);
+}
+
+// One hash per `block_size` block of `data`, the last block padded with zero.
+static bytes HashLevel(const bytes& data, std::size_t block_size) {
+    std::size_t count = AlignUp(data.size(), block_size) / block_size;
+    bytes padded = data;
+    padded.resize(count * block_size, 0);
+    bytes result(count * 0x20);
+    Crypto::Sha256Blocks(padded.data(), block_size, count, result.data());
+    return result;
+}
+
+struct Partition {
+    bytes descriptor; // DIFI header, IVFC and DPFS descriptors, and the master hash
+    bytes body;
+};
+
+// Wraps `data` as IVFC level 4 of a new partition. All DPFS selectors are left zero and both
+// copies of every DPFS level are made identical.
+static Partition MakePartition(const bytes& data, const FormatParams& params) {
+    std::array<std::size_t, 4> ivfc_block_size;
+    for (int i = 0; i < 4; ++i)
+        ivfc_block_size[i] = (std::size_t)1 << params.ivfc_log2_block_size[i];
+    std::size_t dpfs_l2_block_size = (std::size_t)1 << params.dpfs_log2_block_size[0];
+    std::size_t dpfs_l3_block_size = (std::size_t)1 << params.dpfs_log2_block_size[1];
+
+    std::array<bytes, 4> levels;
+    levels[3] = data;
+    for (int i = 2; i >= 0; --i)
+        levels[i] = HashLevel(levels[i + 1], ivfc_block_size[i + 1]);
+    bytes master_hash = HashLevel(levels[0], ivfc_block_size[0]);
+
+    std::array<std::size_t, 4> level_offset;
+    std::size_t inner_end = 0;
+    for (int i = 0; i < 4; ++i) {
+        if (i == 3 && params.external_ivfc_l4) {
+            level_offset[i] = 0;
+            break;
+        }
+        level_offset[i] = AlignUp(inner_end, ivfc_block_size[i]);
+        inner_end = level_offset[i] + levels[i].size();
+    }
+
+    std::size_t dpfs_l3_size = AlignUp(inner_end, dpfs_l3_block_size);
+    std::size_t dpfs_l2_size = AlignUp(dpfs_l3_size / dpfs_l3_block_size, 32) / 8;
+    std::size_t dpfs_l1_size =
+        AlignUp(AlignUp(dpfs_l2_size, dpfs_l2_block_size) / dpfs_l2_block_size, 32) / 8;
+    std::size_t dpfs_l1_offset = 0;
+    std::size_t dpfs_l2_offset = AlignUp(dpfs_l1_offset + dpfs_l1_size * 2, dpfs_l2_block_size);
+    std::size_t dpfs_l3_offset = AlignUp(dpfs_l2_offset + dpfs_l2_size * 2, dpfs_l3_block_size);
+    std::size_t body_size = dpfs_l3_offset + dpfs_l3_size * 2;
+    std::size_t external_l4_offset = 0;
+    if (params.external_ivfc_l4) {
+        external_l4_offset = AlignUp(body_size, ivfc_block_size[3]);
+        body_size = external_l4_offset + levels[3].size();
+    }
+
+    Partition partition;
+    partition.body.resize(body_size, 0);
+    bytes dpfs_l3(dpfs_l3_size, 0);
+    for (int i = 0; i < 4; ++i) {
+        if (i == 3 && params.external_ivfc_l4)
+            Place(partition.body, external_l4_offset, levels[i]);
+        else
+            Place(dpfs_l3, level_offset[i], levels[i]);
+    }
+    Place(partition.body, dpfs_l3_offset, dpfs_l3);
+    Place(partition.body, dpfs_l3_offset + dpfs_l3_size, dpfs_l3);
+
+    bytes& desc = partition.descriptor;
+    DifiHeader difi{};
+    difi.magic = DifiHeader::Magic;
+    difi.version = DifiHeader::Version;
+    difi.ivfc_desc = {sizeof(DifiHeader), sizeof(IvfcDescriptor)};
+    difi.dpfs_desc = {difi.ivfc_desc.offset + difi.ivfc_desc.size, sizeof(DpfsDescriptor)};
+    difi.master_hash = {difi.dpfs_desc.offset + difi.dpfs_desc.size, master_hash.size()};
+    difi.external_ivfc_l4 = params.external_ivfc_l4;
+    difi.dpfs_selector = 0;
+    difi.ivfc_l4_offset = external_l4_offset;
+    desc += Encode(difi);
+
+    IvfcDescriptor ivfc{};
+    ivfc.magic = IvfcDescriptor::Magic;
+    ivfc.version = IvfcDescriptor::Version;
+    ivfc.master_hash_size = master_hash.size();
+    for (int i = 0; i < 4; ++i)
+        ivfc.levels[i] = {level_offset[i], levels[i].size(), params.ivfc_log2_block_size[i]};
+    ivfc.descriptor_size = sizeof(IvfcDescriptor);
+    desc += Encode(ivfc);
+
+    DpfsDescriptor dpfs{};
+    dpfs.magic = DpfsDescriptor::Magic;
+    dpfs.version = DpfsDescriptor::Version;
+    dpfs.levels[0] = {dpfs_l1_offset, dpfs_l1_size, 0};
+    dpfs.levels[1] = {dpfs_l2_offset, dpfs_l2_size, params.dpfs_log2_block_size[0]};
+    dpfs.levels[2] = {dpfs_l3_offset, dpfs_l3_size, params.dpfs_log2_block_size[1]};
+    desc += Encode(dpfs);
+    assert(desc.size() == difi.master_hash.offset);
+
+    desc += master_hash;
+    return partition;
+}
+
+// Writes a FAT node of `size` blocks starting at `index`, with no previous or next node.
+static void PutFatNode(bytes& fat, u32 index, u32 size) {
+    auto set_entry = [&fat](u32 entry, u32 u, u32 v) {
+        Place(fat, (entry + 1) * 8, Encode(u));
+        Place(fat, (entry + 1) * 8 + 4, Encode(v));
+    };
+    set_entry(index, 0x80000000, size > 1 ? 0x80000000 : 0);
+    if (size > 1) {
+        set_entry(index + 1, 0x80000000 + index + 1, index + size);
+        set_entry(index + size - 1, 0x80000000 + index + 1, index + size);
+    }
+}
+
+// An entry table whose dummy entry 0 holds the allocation counters.
+static bytes MakeEntryTable(std::size_t entry_size, u32 entry_count, u32 used_count) {
+    bytes table(entry_count * entry_size, 0);
+    Place(table, 0, Encode(used_count));
+    Place(table, 4, Encode(entry_count));
+    return table;
+}
+
+const char* CheckFormatParams(const FormatParams& params) {
+    const u32 block_size = params.block_size;
+    if (block_size == 0 || (block_size & (block_size - 1)) != 0)
+        return "Block size must be a power of two.";
+    if (params.dir_buckets == 0 || params.file_buckets == 0)
+        return "Bucket counts must not be zero.";
+    if (!params.two_partitions) {
+        u64 dir_blocks = AlignUp((u64)(params.max_dirs + 2ull) * 0x28, block_size) / block_size;
+        u64 file_blocks = AlignUp((u64)(params.max_files + 1ull) * 0x30, block_size) / block_size;
+        if (dir_blocks + file_blocks > params.block_count)
+            return "Block count is too small for the directory and file tables.";
+    }
+    return nullptr;
+}
+
+bytes FormatDisa(const FormatParams& params, AesCmacBlockProvider* block_provider,
+                 const bytes& key) {
+    const u32 block_size = params.block_size;
+    const u32 block_count = params.block_count;
+    const u32 dir_count = params.max_dirs + 2;
+    const u32 file_count = params.max_files + 1;
+    bytes dir_table = MakeEntryTable(0x28, dir_count, 2);
+    bytes file_table = MakeEntryTable(0x30, file_count, 1);
+
+    const u64 dir_hash_offset = 0x88;
+    const u64 file_hash_offset = dir_hash_offset + params.dir_buckets * 4;
+    const u64 fat_offset = file_hash_offset + params.file_buckets * 4;
+    bytes fat((block_count + 1) * 8, 0);
+    const u64 fat_end = fat_offset + fat.size();
+
+    u32 first_free;
+    u64 data_region_offset, dir_table_offset, file_table_offset;
+    u32 dir_blocks = 0, file_blocks = 0;
+    std::size_t save_size;
+    if (params.two_partitions) {
+        first_free = 0;
+        data_region_offset = 0;
+        dir_table_offset = AlignUp(fat_end, 8);
+        file_table_offset = dir_table_offset + dir_table.size();
+        save_size = file_table_offset + file_table.size();
+    } else {
+        // The entry tables live in the data region, in blocks allocated as two FAT chains.
+        dir_blocks = AlignUp(dir_table.size(), block_size) / block_size;
+        file_blocks = AlignUp(file_table.size(), block_size) / block_size;
+        assert(dir_blocks + file_blocks <= block_count);
+        PutFatNode(fat, 0, dir_blocks);
+        PutFatNode(fat, dir_blocks, file_blocks);
+        first_free = dir_blocks + file_blocks;
+        data_region_offset = AlignUp(fat_end, block_size);
+        dir_table_offset = data_region_offset;
+        file_table_offset = data_region_offset + (u64)dir_blocks * block_size;
+        save_size = data_region_offset + (u64)block_count * block_size;
+    }
+    if (first_free < block_count)
+        PutFatNode(fat, first_free, block_count - first_free);
+    Place(fat, 4, Encode<u32>(first_free < block_count ? first_free + 1 : 0));
+
+    SaveHeader save_header{};
+    save_header.magic = SaveHeader::Magic;
+    save_header.version = SaveHeader::Version;
+    save_header.fs_info_offset = 0x20;
+    save_header.image_block_count = AlignUp<u64>(save_size, block_size) / block_size;
+    save_header.image_block_size = block_size;
+    save_header.block_size = block_size;
+    save_header.dir_hash_offset = dir_hash_offset;
+    save_header.dir_buckets = params.dir_buckets;
+    save_header.file_hash_offset = file_hash_offset;
+    save_header.file_buckets = params.file_buckets;
+    save_header.fat_offset = fat_offset;
+    save_header.fat_size = block_count;
+    save_header.data_region_offset = data_region_offset;
+    save_header.data_block_count = block_count;
+    if (params.two_partitions) {
+        save_header.dir_table.offset = dir_table_offset;
+        save_header.file_table.offset = file_table_offset;
+    } else {
+        save_header.dir_table.chain = {0, dir_blocks};
+        save_header.file_table.chain = {dir_blocks, file_blocks};
+    }
+    save_header.max_dirs = params.max_dirs;
+    save_header.max_files = params.max_files;
+
+    bytes save(save_size, 0);
+    Place(save, 0, Encode(save_header));
+    Place(save, fat_offset, fat);
+    Place(save, dir_table_offset, dir_table);
+    Place(save, file_table_offset, file_table);
+
+    std::vector<Partition> partitions;
+    partitions.push_back(MakePartition(save, params));
+    if (params.two_partitions)
+        partitions.push_back(MakePartition(bytes((u64)block_count * block_size, 0), params));
+
+    bytes table;
+    for (const auto& partition : partitions)
+        table += partition.descriptor;
+
+    const u64 table_sec_offset = 0x200;
+    const u64 table_pri_offset = table_sec_offset + AlignUp<u64>(table.size(), 0x10);
+    std::vector<u64> partition_offset;
+    u64 end = table_pri_offset + table.size();
+    for (const auto& partition : partitions) {
+        partition_offset.push_back(AlignUp<u64>(end, 0x1000));
+        end = partition_offset.back() + partition.body.size();
+    }
+
+    bytes image(AlignUp<u64>(end, 0x200), 0);
+    Place(image, table_sec_offset, table);
+    Place(image, table_pri_offset, table);
+    for (std::size_t i = 0; i < partitions.size(); ++i)
+        Place(image, partition_offset[i], partitions[i].body);
+
+    DisaHeader disa{};
+    disa.magic = DisaHeader::Magic;
+    disa.version = DisaHeader::Version;
+    disa.partition_count = partitions.size();
+    disa.table_sec_offset = table_sec_offset;
+    disa.table_pri_offset = table_pri_offset;
+    disa.table_size = table.size();
+    disa.partition_entry[0] = {0, partitions[0].descriptor.size()};
+    disa.partition[0] = {partition_offset[0], partitions[0].body.size()};
+    if (params.two_partitions) {
+        disa.partition_entry[1] = {partitions[0].descriptor.size(),
+                                   partitions[1].descriptor.size()};
+        disa.partition[1] = {partition_offset[1], partitions[1].body.size()};
+    }
+    disa.active_table = 0; // primary
+    bytes header = Encode(disa);
+    header += Crypto::Sha256(table);
+    header.resize(0x100, 0);
+    Place(image, 0x100, header);
+
+    if (block_provider)
+        Place(image, 0, Crypto::AesCmac(block_provider->Hash(header), key));
+    return image;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <array>
+#include "aes_cmac.h"
+#include "bytes.h"
+
+// Geometry of a DISA image to format.
+struct FormatParams {
+    // Block size and block count of the data region, which the FAT manages.
+    u32 block_size = 0x1000;
+    u32 block_count = 0x100;
+
+    // Capacity of the directory and file entry tables, not counting the root and the dummy
+    // entries, and the bucket count of their hash tables.
+    u32 max_dirs = 0x10;
+    u32 max_files = 0x10;
+    u32 dir_buckets = 0x11;
+    u32 file_buckets = 0x11;
+
+    // Put the data region in a second partition instead of in the SAVE partition.
+    bool two_partitions = false;
+
+    // Store IVFC level 4 next to the DPFS levels instead of inside DPFS level 3.
+    bool external_ivfc_l4 = false;
+
+    // log2 of the block size of IVFC levels 1 to 4 and of DPFS levels 2 and 3.
+    std::array<u32, 4> ivfc_log2_block_size{{9, 9, 9, 12}};
+    std::array<u32, 2> dpfs_log2_block_size{{7, 12}};
+};
+
+// Returns why `params` cannot be formatted, or nullptr if it can.
+const char* CheckFormatParams(const FormatParams& params);
+
+// Builds a DISA image with an empty file system of the given geometry, with every IVFC hash
+// filled in. The header CMAC is signed if `block_provider` is given, and left zero otherwise.
+bytes FormatDisa(const FormatParams& params, AesCmacBlockProvider* block_provider = nullptr,
+                 const bytes& key = {});
@@ -1,6 +1,15 @@
 #include <cstdio>
+#include <cstring>
 #include "fs_interface.h"
 
+std::string NameToString(const FsName& name) {
+    return std::string(name.data(), strnlen(name.data(), name.size()));
+}
+
+bool IsHostSafeName(const std::string& name) {
+    return !name.empty() && name != "." && name != ".." && name.find('/') == std::string::npos;
+}
+
 FsPath::FsPath(const char* str) {
     while (true) {
         while (*str == '/')
@@ -35,3 +44,11 @@ FsPath::FsPath(const char* str) {
 FsFileInterface::~FsFileInterface() {}
 
 FsInterface::~FsInterface() {}
+
+bool FsInterface::CanMove(u32 index, u32 parent) {
+    return true;
+}
+
+bool FsInterface::IsReadOnly(u32 index) {
+    return false;
+}
@@ -2,10 +2,18 @@
 #include <array>
 #include <cassert>
 #include <list>
+#include <string>
 #include "bytes.h"
 
 using FsName = std::array<char, 16>;
 
+// `name` up to its first NUL.
+std::string NameToString(const FsName& name);
+
+// Whether `name` can be used as one component of a host or archive path without leading out of
+// its directory or to another path: not empty, "." or "..", and without '/'.
+bool IsHostSafeName(const std::string& name);
+
 class FsPath {
 public:
     FsPath() = default;
@@ -24,6 +32,8 @@ enum class FsResult {
     FileExists,
     DirExists,
     NotFound,
+    // The path leads into storage that could not be read, e.g. a save that is damaged.
+    IoError,
 
     // TooManyFiles,
     // TooManyDirs,
@@ -52,6 +62,7 @@ public:
     virtual std::size_t Write(std::size_t offset, std::size_t size, const u8* buf) = 0;
     virtual std::size_t GetSize() = 0;
     virtual std::size_t SetSize(std::size_t size) = 0;
+    virtual void Flush() = 0;
     virtual void Close() = 0;
 };
 
@@ -99,6 +110,19 @@ public:
     //    - there is no directory or file in `parent` named `name`
     virtual void MoveFile(u32 index, const FsName& name, u32 parent) = 0;
 
+    // Precondition:
+    //    - `index` is a valid directory or file index
+    //    - `parent` is a valid directory index
+    // Return:
+    //    - false if the entry cannot be moved into `parent` at all, e.g. to another save
+    virtual bool CanMove(u32 index, u32 parent);
+
+    // Precondition:
+    //    - `index` is a valid directory index
+    // Return:
+    //    - true if nothing can be created in, removed from or moved out of the directory
+    virtual bool IsReadOnly(u32 index);
+
     // Precondition:
     //    - `index` is a valid directory index
     virtual std::vector<FsName> ListSubDir(u32 index) = 0;
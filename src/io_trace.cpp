@@ -0,0 +1,199 @@
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include "io_trace.h"
+
+namespace IoTrace {
+
+static const char Magic[8] = {'3', 'D', 'S', 'I', 'O', 'T', 'R', 'C'};
+static constexpr u32 Version = 1;
+
+// Record tags.
+static constexpr u8 TagString = 'S';
+static constexpr u8 TagLayer = 'L';
+static constexpr u8 TagFuse = 'F';
+
+static std::atomic<bool> enabled{false};
+static std::mutex mutex;
+static std::FILE* handle = nullptr;
+static std::chrono::steady_clock::time_point epoch;
+static std::unordered_map<std::string, u64> string_ids;
+
+const char* GetOpName(FuseOp op) {
+    static const char* names[] = {
+        "getattr", "readdir", "mkdir", "rmdir", "mknod", "unlink",   "rename",
+        "open",    "read",    "write", "flush", "fsync", "truncate", "release",
+    };
+    return names[(u8)op];
+}
+
+static void PutVarint(u64 value) {
+    u8 buffer[10];
+    std::size_t size = 0;
+    do {
+        buffer[size] = value & 0x7F;
+        value >>= 7;
+        if (value)
+            buffer[size] |= 0x80;
+        ++size;
+    } while (value);
+    std::fwrite(buffer, size, 1, handle);
+}
+
+// Returns the index of `value`, writing its definition on first use.
+static u64 PutString(const std::string& value) {
+    auto found = string_ids.find(value);
+    if (found != string_ids.end())
+        return found->second;
+    u64 id = string_ids.size();
+    string_ids.emplace(value, id);
+    std::fputc(TagString, handle);
+    PutVarint(value.size());
+    std::fwrite(value.data(), value.size(), 1, handle);
+    return id;
+}
+
+static void PutTimes(std::chrono::steady_clock::time_point start) {
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+    auto now = std::chrono::steady_clock::now();
+    PutVarint(start > epoch ? duration_cast<nanoseconds>(start - epoch).count() : 0);
+    PutVarint(duration_cast<nanoseconds>(now - start).count());
+}
+
+bool Open(const char* path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    handle = std::fopen(path, "wb");
+    if (!handle)
+        return false;
+    epoch = std::chrono::steady_clock::now();
+    std::fwrite(Magic, sizeof(Magic), 1, handle);
+    std::fwrite(&Version, sizeof(Version), 1, handle);
+    enabled = true;
+    return true;
+}
+
+void Close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!handle)
+        return;
+    enabled = false;
+    std::fclose(handle);
+    handle = nullptr;
+    string_ids.clear();
+}
+
+bool IsEnabled() {
+    return enabled;
+}
+
+void RecordLayer(const std::string& label, bool write, u64 offset, u64 size,
+                 std::chrono::steady_clock::time_point start) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!handle)
+        return;
+    u64 id = PutString(label);
+    std::fputc(TagLayer, handle);
+    std::fputc(write, handle);
+    PutVarint(id);
+    PutVarint(offset);
+    PutVarint(size);
+    PutTimes(start);
+}
+
+void RecordOp(FuseOp op, const char* path, const char* path2, u64 offset, u64 size,
+              std::chrono::steady_clock::time_point start) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!handle)
+        return;
+    u64 id = PutString(path);
+    u64 id2 = op == FuseOp::Rename ? PutString(path2) : 0;
+    std::fputc(TagFuse, handle);
+    std::fputc((u8)op, handle);
+    PutVarint(id);
+    if (op == FuseOp::Rename)
+        PutVarint(id2);
+    PutVarint(offset);
+    PutVarint(size);
+    PutTimes(start);
+}
+
+Reader::~Reader() {
+    if (handle)
+        std::fclose(handle);
+}
+
+bool Reader::Open(const char* path) {
+    handle = std::fopen(path, "rb");
+    if (!handle)
+        return false;
+    char magic[sizeof(Magic)];
+    u32 version;
+    return std::fread(magic, sizeof(magic), 1, handle) == 1 &&
+           std::memcmp(magic, Magic, sizeof(Magic)) == 0 &&
+           std::fread(&version, sizeof(version), 1, handle) == 1 && version == Version;
+}
+
+bool Reader::ReadVarint(u64& value) {
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        int c = std::fgetc(handle);
+        if (c == EOF)
+            return false;
+        value |= (u64)(c & 0x7F) << shift;
+        if (!(c & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool Reader::ReadString(std::string& value) {
+    u64 id;
+    if (!ReadVarint(id) || id >= strings.size())
+        return false;
+    value = strings[id];
+    return true;
+}
+
+bool Reader::Next(Record& record) {
+    while (true) {
+        int tag = std::fgetc(handle);
+        if (tag == TagString) {
+            u64 size;
+            if (!ReadVarint(size))
+                return false;
+            std::string value(size, '\0');
+            if (size != 0 && std::fread(&value[0], size, 1, handle) != 1)
+                return false;
+            strings.push_back(std::move(value));
+            continue;
+        }
+
+        int kind = std::fgetc(handle);
+        if (kind == EOF)
+            return false;
+        if (tag == TagLayer) {
+            record.kind = Record::Kind::Layer;
+            record.write = kind != 0;
+            if (!ReadString(record.name))
+                return false;
+        } else if (tag == TagFuse) {
+            if (kind > (int)FuseOp::Release)
+                return false;
+            record.kind = Record::Kind::Fuse;
+            record.op = (FuseOp)kind;
+            if (!ReadString(record.name))
+                return false;
+            record.path2.clear();
+            if (record.op == FuseOp::Rename && !ReadString(record.path2))
+                return false;
+        } else {
+            return false;
+        }
+        return ReadVarint(record.offset) && ReadVarint(record.size) &&
+               ReadVarint(record.time_ns) && ReadVarint(record.duration_ns);
+    }
+}
+}
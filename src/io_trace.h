@@ -0,0 +1,76 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "common_types.h"
+
+// Compact binary record of a session: every FUSE operation with the arguments needed to replay
+// it, and every call into an instrumented layer. Strings (paths and layer labels) are written
+// once and referred to by index afterwards, and all numbers are LEB128 varints.
+namespace IoTrace {
+
+enum class FuseOp : u8 {
+    Getattr,
+    Readdir,
+    Mkdir,
+    Rmdir,
+    Mknod,
+    Unlink,
+    Rename,
+    Open,
+    Read,
+    Write,
+    Flush,
+    Fsync,
+    Truncate,
+    Release,
+};
+
+const char* GetOpName(FuseOp op);
+
+bool Open(const char* path);
+void Close();
+bool IsEnabled();
+
+void RecordLayer(const std::string& label, bool write, u64 offset, u64 size,
+                 std::chrono::steady_clock::time_point start);
+
+// `path2` is the new path of a rename. `size` is the open flags of an open, and the new size of
+// a truncate.
+void RecordOp(FuseOp op, const char* path, const char* path2, u64 offset, u64 size,
+              std::chrono::steady_clock::time_point start);
+
+struct Record {
+    enum class Kind {
+        Layer,
+        Fuse,
+    } kind;
+    FuseOp op;   // Fuse only
+    bool write;  // Layer only
+    std::string name; // layer label, or path
+    std::string path2;
+    u64 offset;
+    u64 size;
+    u64 time_ns; // start, since the trace was opened
+    u64 duration_ns;
+};
+
+class Reader {
+public:
+    ~Reader();
+
+    bool Open(const char* path);
+
+    // Reads the next record. Returns false at the end of the trace or on a malformed record.
+    bool Next(Record& record);
+
+private:
+    std::FILE* handle = nullptr;
+    std::vector<std::string> strings;
+
+    bool ReadVarint(u64& value);
+    bool ReadString(std::string& value);
+};
+}
@@ -1,27 +1,140 @@
+#include <algorithm>
+#include "alignment.h"
 #include "crypto.h"
 #include "ivfc_level.h"
+#include "thread_pool.h"
 
 IvfcLevel::IvfcLevel(std::shared_ptr<FileInterface> hash_, std::shared_ptr<FileInterface> body_,
                      std::size_t block_size_)
     : BlockFile(body_->file_size, block_size_), hash(std::move(hash_)), body(std::move(body_)) {}
 
+void IvfcLevel::Rehash() {
+    RehashBlocks(0, GetBlockCount());
+}
+
+void IvfcLevel::SetVerifiedBlocks(std::shared_ptr<std::vector<bool>> verified_) {
+    verified = std::move(verified_);
+}
+
+void IvfcLevel::BeginDeferredHashing() {
+    stale.assign(GetBlockCount(), false);
+}
+
+void IvfcLevel::EndDeferredHashing() {
+    std::vector<bool> blocks = std::move(stale);
+    stale.clear();
+    std::size_t first = 0;
+    while (first < blocks.size()) {
+        if (!blocks[first]) {
+            ++first;
+            continue;
+        }
+        std::size_t end = first;
+        while (end < blocks.size() && blocks[end])
+            ++end;
+        RehashBlocks(first, end - first);
+        first = end;
+    }
+}
+
 bytes IvfcLevel::ReadBlock(std::size_t block_index) {
-    std::size_t offset = block_index * block_size;
-    std::size_t upper = offset + block_size;
-    std::size_t end = std::min(upper, file_size);
-    auto result = body->Read(offset, end - offset);
-    result += bytes(upper - end, 0);
-    if (hash->Read(block_index * 0x20, 0x20) != Crypto::Sha256(result))
-        result = bytes(block_size, 0xDD);
+    bytes result(block_size);
+    ReadBlocks(block_index, 1, result.data());
     return result;
 }
 
 void IvfcLevel::WriteBlock(std::size_t block_index, const bytes& data) {
-    hash->Write(block_index * 0x20, Crypto::Sha256(data));
+    WriteBlocks(block_index, 1, data.data());
+}
 
-    std::size_t offset = block_index * block_size;
-    std::size_t upper = offset + block_size;
+void IvfcLevel::ReadBlocks(std::size_t first, std::size_t count, u8* dst) {
+    std::size_t offset = first * block_size;
+    std::size_t upper = offset + count * block_size;
     std::size_t end = std::min(upper, file_size);
-    auto buffer = bytes(data.begin(), data.begin() + (end - offset));
-    body->Write(offset, buffer);
+    body->Read(offset, end - offset, dst);
+    std::fill(dst + (end - offset), dst + count * block_size, 0);
+
+    // Blocks already verified, or written while hashing is deferred, are trusted.
+    auto trusted = [this](std::size_t block) {
+        return (verified && (*verified)[block]) || (!stale.empty() && stale[block]);
+    };
+    bool all_trusted = true;
+    for (std::size_t i = 0; i < count && all_trusted; ++i)
+        all_trusted = trusted(first + i);
+    if (all_trusted)
+        return;
+
+    hashes.resize(count * 0x40);
+    u8* expected = hashes.data();
+    u8* actual = expected + count * 0x20;
+    hash->Read(first * 0x20, count * 0x20, expected);
+    HashBlocks(dst, count, actual);
+    for (std::size_t i = 0; i < count; ++i) {
+        if (trusted(first + i))
+            continue;
+        if (std::memcmp(expected + i * 0x20, actual + i * 0x20, 0x20) != 0) {
+            std::memset(dst + i * block_size, 0xDD, block_size);
+            if (stats)
+                ++stats->hash_failures;
+        } else if (verified)
+            (*verified)[first + i] = true;
+    }
+}
+
+void IvfcLevel::WriteBlocks(std::size_t first, std::size_t count, const u8* src) {
+    std::size_t offset = first * block_size;
+    std::size_t upper = offset + count * block_size;
+    std::size_t end = std::min(upper, file_size);
+
+    if (!stale.empty()) {
+        std::fill(stale.begin() + first, stale.begin() + first + count, true);
+    } else {
+        // The part of the last block past the end of the level is not stored and is hashed as
+        // zero.
+        hashes.resize(count * 0x20);
+        if (end == upper) {
+            HashBlocks(src, count, hashes.data());
+        } else {
+            bytes padded(src, src + count * block_size);
+            std::fill(padded.begin() + (end - offset), padded.end(), 0);
+            HashBlocks(padded.data(), count, hashes.data());
+        }
+        hash->Write(first * 0x20, count * 0x20, hashes.data());
+        if (verified)
+            std::fill(verified->begin() + first, verified->begin() + first + count, true);
+    }
+
+    body->Write(offset, end - offset, src);
+}
+
+void IvfcLevel::HashBlocks(const u8* data, std::size_t count, u8* out) {
+    constexpr std::size_t blocks_per_task = 8;
+    if (stats)
+        stats->blocks_hashed += count;
+    if (count <= blocks_per_task) {
+        Crypto::Sha256Blocks(data, block_size, count, out);
+        return;
+    }
+    std::size_t task_count = AlignUp(count, blocks_per_task) / blocks_per_task;
+    ThreadPool::Default().ParallelFor(task_count, [&](std::size_t task) {
+        std::size_t first = task * blocks_per_task;
+        Crypto::Sha256Blocks(data + first * block_size, block_size,
+                             std::min(blocks_per_task, count - first), out + first * 0x20);
+    });
+}
+
+void IvfcLevel::RehashBlocks(std::size_t first, std::size_t count) {
+    constexpr std::size_t blocks_per_pass = 0x400;
+    for (std::size_t pass = first; pass < first + count; pass += blocks_per_pass) {
+        std::size_t pass_count = std::min(blocks_per_pass, first + count - pass);
+        std::size_t offset = pass * block_size;
+        std::size_t end = std::min(offset + pass_count * block_size, file_size);
+        bytes data(pass_count * block_size);
+        body->Read(offset, end - offset, data.data());
+        bytes pass_hashes(pass_count * 0x20);
+        HashBlocks(data.data(), pass_count, pass_hashes.data());
+        hash->Write(pass * 0x20, pass_hashes);
+        if (verified)
+            std::fill(verified->begin() + pass, verified->begin() + pass + pass_count, true);
+    }
 }
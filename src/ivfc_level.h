@@ -3,16 +3,39 @@
 #include <memory>
 #include "block_file.h"
 
-class IvfcLevel : public BlockFile {
+class IvfcLevel final : public BlockFile {
 public:
     IvfcLevel(std::shared_ptr<FileInterface> hash_, std::shared_ptr<FileInterface> body_,
               std::size_t block_size_);
 
+    // Recomputes the hash of every block from the current body.
+    void Rehash();
+
+    // Shares a map of blocks already known to match their hash, which are then not re-hashed on
+    // read. Blocks are added to it as they are verified or written.
+    void SetVerifiedBlocks(std::shared_ptr<std::vector<bool>> verified_);
+
+    // Between these calls, writes leave the hashes stale and written blocks read back unverified.
+    // EndDeferredHashing() then hashes each written block once.
+    void BeginDeferredHashing();
+    void EndDeferredHashing();
+
 protected:
     bytes ReadBlock(std::size_t block_index) override;
     void WriteBlock(std::size_t block_index, const bytes& data) override;
+    // Blocks in the range are read, hashed and verified in parallel, with one body access and one
+    // hash access for the whole range.
+    void ReadBlocks(std::size_t first, std::size_t count, u8* dst) override;
+    void WriteBlocks(std::size_t first, std::size_t count, const u8* src) override;
 
 private:
     std::shared_ptr<FileInterface> hash;
     std::shared_ptr<FileInterface> body;
+    std::shared_ptr<std::vector<bool>> verified;
+    std::vector<bool> stale; // empty unless hashing is deferred
+
+    bytes hashes; // scratch for the hashes of the current access
+    void HashBlocks(const u8* data, std::size_t count, u8* out);
+    // Rehashes blocks [first, first + count) from the body without verifying them.
+    void RehashBlocks(std::size_t first, std::size_t count);
 };
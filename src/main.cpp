@@ -1,25 +1,170 @@
+#include <algorithm>
+#include <chrono>
+#include <csignal>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <map>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include <dirent.h>
+#include <fcntl.h>
 #include <fuse.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "aes_ctr.h"
 #include "aes_key.h"
+#include "alloc_count.h"
+#include "bulk.h"
+#include "check.h"
 #include "crypto.h"
 #include "disa.h"
 #include "disk_file.h"
+#include "format.h"
 #include "fs_interface.h"
+#include "io_trace.h"
+#include "memory_file.h"
+#include "multi_save.h"
+#include "stats.h"
+#include "tar.h"
+#include "thread_pool.h"
+#include "trace.h"
 
 std::unique_ptr<FsInterface> interface;
 std::mutex interface_lock;
+std::shared_ptr<StatsRegistry> stats;
+
+// Read-only virtual files exposed next to the save content.
+static const char* VirtualDir = "/.3dsfuse";
+static const char* StatsFile = "/.3dsfuse/stats";
+
+static bool IsVirtualPath(const char* path) {
+    std::size_t length = std::strlen(VirtualDir);
+    return std::strncmp(path, VirtualDir, length) == 0 &&
+           (path[length] == '\0' || path[length] == '/');
+}
+
+static std::string RenderStats() {
+    return stats->Dump();
+}
+
+static const char* stats_dump_path = nullptr;
+
+// The container, when --in-memory is given.
+static std::shared_ptr<CachedFile> ram_image;
+
+// Writes the statistics to the --stats-dump file, or stderr, on every SIGUSR1. The signal is
+// blocked in all threads and picked up here by sigwait.
+static void StatsDumpLoop() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    int signal;
+    while (sigwait(&signals, &signal) == 0) {
+        std::string text = RenderStats();
+        std::FILE* out = stats_dump_path ? std::fopen(stats_dump_path, "w") : stderr;
+        if (!out)
+            continue;
+        std::fputs(text.c_str(), out);
+        if (out != stderr)
+            std::fclose(out);
+    }
+}
+
+// Times one FUSE operation into its latency histogram, the trace and the I/O trace, and counts
+// its heap allocations. `path2`, `offset` and `size` are recorded for replay as described in
+// IoTrace::RecordOp.
+class OpScope {
+public:
+    OpScope(IoTrace::FuseOp op_, const char* path_, const char* path2_ = nullptr, u64 offset_ = 0,
+            u64 size_ = 0)
+        : op(op_), path(path_), path2(path2_), offset(offset_), size(size_),
+          start(std::chrono::steady_clock::now()), allocations(GetThreadAllocationCount()) {}
+    ~OpScope() {
+        const char* name = IoTrace::GetOpName(op);
+        stats->GetOp(name).Record(start, GetThreadAllocationCount() - allocations);
+        if (Trace::IsEnabled())
+            Trace::Span("fuse", name, start, Trace::Arg("path", path));
+        if (IoTrace::IsEnabled())
+            IoTrace::RecordOp(op, path, path2, offset, size, start);
+    }
+
+private:
+    IoTrace::FuseOp op;
+    const char* path;
+    const char* path2;
+    u64 offset;
+    u64 size;
+    std::chrono::steady_clock::time_point start;
+    u64 allocations;
+};
+
+// Charges the container writes, hashing, ciphering and signing done during its lifetime to `path`.
+// Must live inside interface_lock so that no other operation's work is counted.
+class WriteScope {
+public:
+    WriteScope(const char* path_, u64 logical_bytes_ = 0)
+        : path(path_), logical_bytes(logical_bytes_), before(stats->GetWork()) {}
+    ~WriteScope() {
+        stats->AccountWrite(path, logical_bytes, before);
+    }
+
+private:
+    const char* path;
+    u64 logical_bytes;
+    WriteWork before;
+};
+
+// A snapshot of generated text, served through a file handle.
+class TextFile : public FsFileInterface {
+public:
+    TextFile(std::string text_) : text(std::move(text_)) {}
+    std::size_t Read(std::size_t offset, std::size_t size, u8* buf) override {
+        if (offset >= text.size())
+            return 0;
+        size = std::min(size, text.size() - offset);
+        std::memcpy(buf, text.data() + offset, size);
+        return size;
+    }
+    std::size_t Write(std::size_t offset, std::size_t size, const u8* buf) override {
+        return 0;
+    }
+    std::size_t GetSize() override {
+        return text.size();
+    }
+    std::size_t SetSize(std::size_t size) override {
+        return text.size();
+    }
+    void Flush() override {}
+    void Close() override {
+        delete this;
+    }
+
+private:
+    std::string text;
+};
 
 namespace FuseCallback {
 int getattr(const char* path, struct stat* stbuf) {
+    OpScope scope(IoTrace::FuseOp::Getattr, path);
     memset(stbuf, 0, sizeof(struct stat));
     std::lock_guard<std::mutex> lock(interface_lock);
+    if (IsVirtualPath(path)) {
+        if (std::strcmp(path, VirtualDir) == 0) {
+            stbuf->st_mode = S_IFDIR | 0555;
+            stbuf->st_nlink = 2;
+            return 0;
+        }
+        if (std::strcmp(path, StatsFile) == 0) {
+            stbuf->st_mode = S_IFREG | 0444;
+            stbuf->st_nlink = 1;
+            stbuf->st_size = RenderStats().size();
+            return 0;
+        }
+        return -ENOENT;
+    }
     auto s = interface->Find(path);
     switch (s.result) {
     case FsResult::InvalidPath:
@@ -39,6 +184,8 @@ int getattr(const char* path, struct stat* stbuf) {
         stbuf->st_nlink = 1;
         stbuf->st_size = interface->GetFileSize(s.index);
         return 0;
+    case FsResult::IoError:
+        return -EIO;
     default:
         assert(false);
     }
@@ -46,7 +193,16 @@ int getattr(const char* path, struct stat* stbuf) {
 
 int readdir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset,
             struct fuse_file_info* fi) {
+    OpScope scope(IoTrace::FuseOp::Readdir, path);
     std::lock_guard<std::mutex> lock(interface_lock);
+    if (IsVirtualPath(path)) {
+        if (std::strcmp(path, VirtualDir) != 0)
+            return -ENOTDIR;
+        filler(buf, ".", NULL, 0);
+        filler(buf, "..", NULL, 0);
+        filler(buf, StatsFile + std::strlen(VirtualDir) + 1, NULL, 0);
+        return 0;
+    }
     auto s = interface->Find(path);
     switch (s.result) {
     case FsResult::InvalidPath:
@@ -71,13 +227,19 @@ int readdir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset,
         }
 
         return 0;
+    case FsResult::IoError:
+        return -EIO;
     default:
         assert(false);
     }
 }
 
 int mkdir(const char* path, mode_t mode) {
+    OpScope scope(IoTrace::FuseOp::Mkdir, path);
+    if (IsVirtualPath(path))
+        return -EACCES;
     std::lock_guard<std::mutex> lock(interface_lock);
+    WriteScope write_scope(path);
     auto s = interface->Find(path);
     switch (s.result) {
     case FsResult::InvalidPath:
@@ -89,18 +251,26 @@ int mkdir(const char* path, mode_t mode) {
     case FsResult::FileExists:
         return -EEXIST;
     case FsResult::NotFound: {
+        if (interface->IsReadOnly(s.parent))
+            return -EACCES;
         u32 index = interface->MakeDir(s.name, s.parent);
         if (index == 0)
             return -ENOSPC;
         return 0;
     }
+    case FsResult::IoError:
+        return -EIO;
     default:
         assert(false);
     }
 }
 
 int rmdir(const char* path) {
+    OpScope scope(IoTrace::FuseOp::Rmdir, path);
+    if (IsVirtualPath(path))
+        return -EACCES;
     std::lock_guard<std::mutex> lock(interface_lock);
+    WriteScope write_scope(path);
     auto s = interface->Find(path);
     switch (s.result) {
     case FsResult::InvalidPath:
@@ -111,17 +281,26 @@ int rmdir(const char* path) {
     case FsResult::FileExists:
         return -ENOTDIR;
     case FsResult::DirExists:
+        // The root has no parent.
+        if (interface->IsReadOnly(s.index) || (s.parent != 0 && interface->IsReadOnly(s.parent)))
+            return -EACCES;
         if (!interface->RemoveDir(s.index)) {
             return -ENOTEMPTY;
         }
         return 0;
+    case FsResult::IoError:
+        return -EIO;
     default:
         assert(false);
     }
 }
 
 int mknod(const char* path, mode_t mode, dev_t dev) {
+    OpScope scope(IoTrace::FuseOp::Mknod, path);
+    if (IsVirtualPath(path))
+        return -EACCES;
     std::lock_guard<std::mutex> lock(interface_lock);
+    WriteScope write_scope(path);
     auto s = interface->Find(path);
     switch (s.result) {
     case FsResult::InvalidPath:
@@ -133,18 +312,26 @@ int mknod(const char* path, mode_t mode, dev_t dev) {
     case FsResult::FileExists:
         return -EEXIST;
     case FsResult::NotFound: {
+        if (interface->IsReadOnly(s.parent))
+            return -EACCES;
         u32 index = interface->MakeFile(s.name, s.parent);
         if (index == 0)
             return -ENOSPC;
         return 0;
     }
+    case FsResult::IoError:
+        return -EIO;
     default:
         assert(false);
     }
 }
 
 int unlink(const char* path) {
+    OpScope scope(IoTrace::FuseOp::Unlink, path);
+    if (IsVirtualPath(path))
+        return -EACCES;
     std::lock_guard<std::mutex> lock(interface_lock);
+    WriteScope write_scope(path);
     auto s = interface->Find(path);
     switch (s.result) {
     case FsResult::InvalidPath:
@@ -158,17 +345,32 @@ int unlink(const char* path) {
     case FsResult::FileExists:
         interface->RemoveFile(s.index);
         return 0;
+    case FsResult::IoError:
+        return -EIO;
     default:
         assert(false);
     }
 }
 
 int rename(const char* path, const char* new_path) {
+    OpScope scope(IoTrace::FuseOp::Rename, path, new_path);
     // TODO: check for EINVAL
     // (The new directory pathname contains a path prefix that names the old directory)
+    if (IsVirtualPath(path) || IsVirtualPath(new_path))
+        return -EACCES;
     std::lock_guard<std::mutex> lock(interface_lock);
+    WriteScope write_scope(path);
     auto s = interface->Find(path);
     auto s_new = interface->Find(new_path);
+    bool found = s.result == FsResult::DirExists || s.result == FsResult::FileExists;
+    bool found_parent = s_new.result == FsResult::NotFound ||
+                        s_new.result == FsResult::DirExists ||
+                        s_new.result == FsResult::FileExists;
+    if (found && found_parent && s.parent != 0 && s_new.parent != 0 &&
+        (interface->IsReadOnly(s.parent) || interface->IsReadOnly(s_new.parent)))
+        return -EACCES;
+    if (found && found_parent && !interface->CanMove(s.index, s_new.parent))
+        return -EXDEV;
     switch (s.result) {
     case FsResult::InvalidPath:
     case FsResult::PathNotFound:
@@ -190,6 +392,8 @@ int rename(const char* path, const char* new_path) {
             [[fallthrough]] case FsResult::NotFound
                 : interface->MoveDir(s.index, s_new.name, s_new.parent);
             return 0;
+        case FsResult::IoError:
+            return -EIO;
         default:
             assert(false);
         }
@@ -208,16 +412,31 @@ int rename(const char* path, const char* new_path) {
             [[fallthrough]] case FsResult::NotFound
                 : interface->MoveFile(s.index, s_new.name, s_new.parent);
             return 0;
+        case FsResult::IoError:
+            return -EIO;
         default:
             assert(false);
         }
+    case FsResult::IoError:
+        return -EIO;
     default:
         assert(false);
     }
 }
 
 int open(const char* path, struct fuse_file_info* fi) {
+    OpScope scope(IoTrace::FuseOp::Open, path, nullptr, 0, (u64)fi->flags);
     std::lock_guard<std::mutex> lock(interface_lock);
+    if (IsVirtualPath(path)) {
+        if (std::strcmp(path, StatsFile) != 0)
+            return -EISDIR;
+        if ((fi->flags & O_ACCMODE) != O_RDONLY)
+            return -EACCES;
+        // The content is generated on open, so its size may differ from what getattr reported.
+        fi->direct_io = 1;
+        fi->fh = (std::uint64_t) new TextFile(RenderStats());
+        return 0;
+    }
     auto s = interface->Find(path);
     switch (s.result) {
     case FsResult::InvalidPath:
@@ -228,26 +447,57 @@ int open(const char* path, struct fuse_file_info* fi) {
         return -ENOTDIR;
     case FsResult::DirExists:
         return -EISDIR;
-    case FsResult::FileExists:
-        fi->fh = (std::uint64_t)interface->Open(s.index);
+    case FsResult::FileExists: {
+        FsFileInterface* file = interface->Open(s.index);
+        if (!file)
+            return -EIO;
+        fi->fh = (std::uint64_t)file;
         return 0;
+    }
+    case FsResult::IoError:
+        return -EIO;
     default:
         assert(false);
     }
 }
 
 int read(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
+    OpScope scope(IoTrace::FuseOp::Read, path, nullptr, offset, size);
     std::lock_guard<std::mutex> lock(interface_lock);
     return ((FsFileInterface*)fi->fh)->Read(offset, size, (u8*)buf);
 }
 
 int write(const char* path, const char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
+    OpScope scope(IoTrace::FuseOp::Write, path, nullptr, offset, size);
     std::lock_guard<std::mutex> lock(interface_lock);
+    WriteScope write_scope(path, size);
     return ((FsFileInterface*)fi->fh)->Write(offset, size, (const u8*)buf);
 }
 
+int flush(const char* path, struct fuse_file_info* fi) {
+    OpScope scope(IoTrace::FuseOp::Flush, path);
+    std::lock_guard<std::mutex> lock(interface_lock);
+    WriteScope write_scope(path);
+    ((FsFileInterface*)fi->fh)->Flush();
+    return 0;
+}
+
+int fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+    OpScope scope(IoTrace::FuseOp::Fsync, path);
+    std::lock_guard<std::mutex> lock(interface_lock);
+    WriteScope write_scope(path);
+    ((FsFileInterface*)fi->fh)->Flush();
+    if (ram_image)
+        ram_image->Flush();
+    return 0;
+}
+
 int truncate(const char* path, off_t size) {
+    OpScope scope(IoTrace::FuseOp::Truncate, path, nullptr, 0, size);
+    if (IsVirtualPath(path))
+        return -EACCES;
     std::lock_guard<std::mutex> lock(interface_lock);
+    WriteScope write_scope(path);
     auto s = interface->Find(path);
     switch (s.result) {
     case FsResult::InvalidPath:
@@ -261,20 +511,143 @@ int truncate(const char* path, off_t size) {
     case FsResult::FileExists: {
         // TODO error
         auto file = interface->Open(s.index);
+        if (!file)
+            return -EIO;
         file->SetSize(size);
         file->Close();
         return 0;
     }
+    case FsResult::IoError:
+        return -EIO;
     default:
         assert(false);
     }
 }
 
 int release(const char* path, struct fuse_file_info* fi) {
+    OpScope scope(IoTrace::FuseOp::Release, path);
     std::lock_guard<std::mutex> lock(interface_lock);
+    WriteScope write_scope(path);
     ((FsFileInterface*)fi->fh)->Close();
     return 0;
 }
+
+void* init() {
+    // Started here rather than in main because fuse_main may fork into the background first.
+    std::thread(StatsDumpLoop).detach();
+    return nullptr;
+}
+}
+
+// Opens `path` for writing, or stdout if it is "-". Output then gets its own handle on stdout, and
+// messages printed to stdout go to stderr.
+static std::FILE* OpenOutput(const char* path) {
+    std::FILE* file;
+    if (std::strcmp(path, "-") == 0) {
+        std::fflush(stdout);
+        file = fdopen(dup(STDOUT_FILENO), "wb");
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    } else {
+        file = std::fopen(path, "wb");
+    }
+    if (!file)
+        std::fprintf(stderr, "Failed to open %s\n", path);
+    return file;
+}
+
+// Drives the FUSE callbacks with the operations recorded in `trace_path`. Writes carry a fixed
+// pattern, since traces only keep their size. Handles are matched to the last open of a path.
+static int Replay(const char* trace_path) {
+    IoTrace::Reader reader;
+    if (!reader.Open(trace_path)) {
+        std::printf("Failed to open trace %s\n", trace_path);
+        return 1;
+    }
+
+    using IoTrace::FuseOp;
+    std::map<std::string, std::vector<fuse_file_info>> handles;
+    auto fill = [](void*, const char*, const struct stat*, off_t) { return 0; };
+    std::vector<char> buffer;
+    u64 op_count = 0;
+    auto start = std::chrono::steady_clock::now();
+    IoTrace::Record record;
+    while (reader.Next(record)) {
+        if (record.kind != IoTrace::Record::Kind::Fuse)
+            continue;
+        ++op_count;
+        const char* path = record.name.c_str();
+        auto& path_handles = handles[record.name];
+        struct stat st;
+        switch (record.op) {
+        case FuseOp::Getattr:
+            FuseCallback::getattr(path, &st);
+            break;
+        case FuseOp::Readdir:
+            FuseCallback::readdir(path, nullptr, fill, 0, nullptr);
+            break;
+        case FuseOp::Mkdir:
+            FuseCallback::mkdir(path, 0755);
+            break;
+        case FuseOp::Rmdir:
+            FuseCallback::rmdir(path);
+            break;
+        case FuseOp::Mknod:
+            FuseCallback::mknod(path, S_IFREG | 0644, 0);
+            break;
+        case FuseOp::Unlink:
+            FuseCallback::unlink(path);
+            break;
+        case FuseOp::Rename:
+            FuseCallback::rename(path, record.path2.c_str());
+            break;
+        case FuseOp::Open: {
+            fuse_file_info fi{};
+            fi.flags = (int)record.size;
+            if (FuseCallback::open(path, &fi) == 0)
+                path_handles.push_back(fi);
+            break;
+        }
+        case FuseOp::Read:
+        case FuseOp::Write:
+            if (path_handles.empty())
+                break;
+            buffer.assign(record.size, (char)0xA5);
+            if (record.op == FuseOp::Read)
+                FuseCallback::read(path, buffer.data(), record.size, record.offset,
+                                   &path_handles.back());
+            else
+                FuseCallback::write(path, buffer.data(), record.size, record.offset,
+                                    &path_handles.back());
+            break;
+        case FuseOp::Flush:
+            if (!path_handles.empty())
+                FuseCallback::flush(path, &path_handles.back());
+            break;
+        case FuseOp::Fsync:
+            if (!path_handles.empty())
+                FuseCallback::fsync(path, 0, &path_handles.back());
+            break;
+        case FuseOp::Truncate:
+            FuseCallback::truncate(path, record.size);
+            break;
+        case FuseOp::Release:
+            if (!path_handles.empty()) {
+                FuseCallback::release(path, &path_handles.back());
+                path_handles.pop_back();
+            }
+            break;
+        }
+    }
+    for (auto& entry : handles) {
+        for (auto& fi : entry.second)
+            FuseCallback::release(entry.first.c_str(), &fi);
+    }
+
+    double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("Replayed %llu operations in %.3f s\n\n%s", (unsigned long long)op_count,
+                seconds, RenderStats().c_str());
+    return 0;
 }
 
 static constexpr char DigitToHex(u8 value) {
@@ -308,20 +681,141 @@ std::string HashMovableKey(const bytes& key) {
     return id0;
 }
 
+// Names in the host directory `path`, but "." and "..". Empty if it cannot be opened.
+static std::vector<std::string> ListHostDir(const std::string& path) {
+    std::vector<std::string> names;
+    DIR* d = opendir(path.c_str());
+    if (d == nullptr)
+        return names;
+    while (dirent* dir = readdir(d)) {
+        if (std::strcmp(dir->d_name, ".") != 0 && std::strcmp(dir->d_name, "..") != 0)
+            names.push_back(dir->d_name);
+    }
+    closedir(d);
+    return names;
+}
+
+// Path of the save of title `id` in the ID1 directory of an SD card.
+static std::string SdSavePath(u64 id) {
+    return "/title/" + IntToHex((u32)(id >> 32)) + "/" + IntToHex((u32)(id & 0xFFFFFFFF)) +
+           "/data/00000001.sav";
+}
+
+// Counter of the SD file at `sub_path` in the ID1 directory.
+static bytes SdFileIv(const std::string& sub_path) {
+    bytes path_to_hash;
+    // TODO proper UTF-8 to UTF-16?
+    for (char c : sub_path) {
+        path_to_hash.push_back((byte)c);
+        path_to_hash.push_back(0);
+    }
+
+    path_to_hash.push_back(0);
+    path_to_hash.push_back(0);
+
+    bytes iv = Crypto::Sha256(path_to_hash);
+    for (unsigned i = 0; i < 16; ++i) {
+        iv[i] ^= iv[i + 16];
+    }
+    iv.resize(16);
+    return iv;
+}
+
+enum class SaveCheck { Unchecked, Clean, Damaged };
+
+// Opens a save of a mount of every save, or returns nullptr if `container` could not be opened or
+// the save is damaged or not signed with `key`, which Disa asserts on. The save is checked in full
+// the first time, and `check` keeps the outcome for when it is opened again.
+static std::unique_ptr<FsInterface> OpenCheckedSave(
+    std::shared_ptr<FileInterface> container, std::unique_ptr<AesCmacBlockProvider> block_provider,
+    const bytes& key, const DisaOptions& options, SaveCheck& check) {
+    const char* label = options.label_prefix.c_str();
+    if (!container) {
+        std::fprintf(stderr, "Failed to open save %s\n", label);
+        return nullptr;
+    }
+    if (check == SaveCheck::Unchecked) {
+        CheckReport report =
+            CheckDisa(container, block_provider.get(), key, ThreadPool::Default());
+        check = report.IsClean() ? SaveCheck::Clean : SaveCheck::Damaged;
+        if (check == SaveCheck::Damaged) {
+            std::fprintf(stderr, "Save %s is damaged: %s: %s\n", label,
+                         report.problems[0].where.c_str(), report.problems[0].what.c_str());
+        }
+    }
+    if (check == SaveCheck::Damaged)
+        return nullptr;
+    return std::make_unique<Disa>(std::move(container), std::move(block_provider), key, options);
+}
+
 int main(int argc, char* argv[]) {
+    // Before any thread starts, so that every thread inherits the mask and only sigwait in
+    // StatsDumpLoop picks up SIGUSR1.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
     if (argc < 2) {
-        std::printf("usage: %s SOURCE [3DS_OPTION] MOUNT_POINT [FUSE_OPTION]...", argv[0]);
+        std::printf("usage: %s SOURCE [3DS_OPTION] MOUNT_POINT [FUSE_OPTION]...\n", argv[0]);
+        std::printf("       %s FILE --format [FORMAT_OPTION]...", argv[0]);
         std::printf(R"(
 3DS_OPTION:
     --disa                 Mount SOURCE as bare DISA file.
     --sdsave               Mount save data in SD card. SOURCE is the SD card root path.
-                           --id, --movable, --boot9 and --const required.
+                           --movable, --boot9 and --const required.
     --nandsave             Mount save data in NAND filesystem. SOURCE is the NAND root path.
-                           --id, --boot9 and --const required.
-    --id ID                ID (32- or 64-bit hex) of the save to mount
+                           --boot9 and --const required.
+    --id ID                ID (32- or 64-bit hex) of the save to mount. Without it, every save
+                           is mounted, as title/HIGH/LOW for SD or sysdata/ID for NAND, and
+                           opened on first access
     --moveable MOVABLESED  movable.sed file required for decrypting SD files
     --boot9 BOOT9BIN       boot9.bin file required for generating AES keys
     --const CONSTANT       a 16-byte file that contains the key scrambler constant (hint: start with 0x1F)
+    --lazy                 Defer loading the FAT and data partition until a file is opened, and
+                           checking the CMAC header until the first write
+    --in-memory            Load the whole (decrypted) image into RAM and run against it, writing
+                           changed regions back only on fsync and unmount
+    --cache SIZE           Keep up to SIZE bytes of verified blocks in RAM, shared by all mounted
+                           saves, dropping the least recently used first
+    --trace FILE           Write a Chrome trace event log of every operation and layer call
+                           to FILE
+    --stats-dump FILE      Write the statistics of /.3dsfuse/stats to FILE on SIGUSR1
+                           (default: stderr)
+    --verify-cache FILE    Remember verified blocks in FILE, so that remounting the same unchanged
+                           image skips re-verifying them
+    --record FILE          Record every FUSE operation and layer call to FILE in a compact binary
+                           form, for --replay
+    --replay FILE          Instead of mounting, replay the operations recorded in FILE against an
+                           in-memory copy-on-write copy of SOURCE, leaving SOURCE untouched, and
+                           print the statistics. MOUNT_POINT is not needed.
+    --extract DIR          Instead of mounting, copy every file of SOURCE into DIR. MOUNT_POINT is
+                           not needed.
+    --pack DIR             Instead of mounting, copy every file of DIR into SOURCE, replacing
+                           existing files, and re-hash and re-sign SOURCE once at the end.
+                           MOUNT_POINT is not needed.
+    --export-tar FILE      Instead of mounting, write every file of SOURCE to FILE as a tar
+                           archive, or to stdout if FILE is -. MOUNT_POINT is not needed.
+    --import-tar FILE      Instead of mounting, write every file of the tar archive FILE, or of
+                           stdin if FILE is -, into SOURCE, like --pack.
+    --check REPORT         Instead of mounting, check every hash, the FAT and the directory
+                           and file tables of SOURCE without modifying it, and write a JSON
+                           report to REPORT, or to stdout if REPORT is -. Exits with 2 if
+                           problems are found. MOUNT_POINT is not needed.
+    --jobs N               Number of threads doing host file I/O for --extract and --pack, or
+                           hashing for --check (default: one per CPU)
+
+FORMAT_OPTION:
+    --format               Write an empty bare DISA file to SOURCE instead of mounting. The
+                           geometry is set by the following options.
+    --block-size SIZE      Data region block size (default 0x1000)
+    --blocks COUNT         Data region block count (default 0x100)
+    --max-dirs COUNT       Directory capacity, not counting the root (default 0x10)
+    --max-files COUNT      File capacity (default 0x10)
+    --dir-buckets COUNT    Directory hash table buckets (default 0x11)
+    --file-buckets COUNT   File hash table buckets (default 0x11)
+    --two-partitions       Put the data region in its own partition
+    --external-l4          Store IVFC level 4 outside of DPFS
 )");
         return 0;
     }
@@ -340,6 +834,19 @@ int main(int argc, char* argv[]) {
 
     const char* in_id = nullptr;
     const char* in_movable = nullptr;
+    const char* in_verify_cache = nullptr;
+    bool lazy = false;
+    bool in_memory = false;
+    std::size_t cache_size = 0;
+    bool format = false;
+    const char* in_replay = nullptr;
+    const char* in_extract = nullptr;
+    const char* in_pack = nullptr;
+    const char* in_export_tar = nullptr;
+    const char* in_import_tar = nullptr;
+    const char* in_check = nullptr;
+    unsigned jobs = std::max(std::thread::hardware_concurrency(), 1u);
+    FormatParams format_params;
 
     bytes key_c;
     bytes key_x_sign;
@@ -370,6 +877,76 @@ int main(int argc, char* argv[]) {
             auto boot9 = OpenDiskFile(argv[i]);
             key_x_sign = boot9->Read(0xd9e0, 0x10);
             key_x_dec = boot9->Read(0xd9f0, 0x10);
+        } else if (std::strcmp(argv[i], "--trace") == 0) {
+            advance_i();
+            if (!Trace::Open(argv[i])) {
+                printf("Failed to open %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (std::strcmp(argv[i], "--stats-dump") == 0) {
+            advance_i();
+            stats_dump_path = argv[i];
+        } else if (std::strcmp(argv[i], "--lazy") == 0) {
+            lazy = true;
+        } else if (std::strcmp(argv[i], "--in-memory") == 0) {
+            in_memory = true;
+        } else if (std::strcmp(argv[i], "--cache") == 0) {
+            advance_i();
+            cache_size = (std::size_t)std::strtoull(argv[i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "--verify-cache") == 0) {
+            advance_i();
+            in_verify_cache = argv[i];
+        } else if (std::strcmp(argv[i], "--record") == 0) {
+            advance_i();
+            if (!IoTrace::Open(argv[i])) {
+                printf("Failed to open %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (std::strcmp(argv[i], "--replay") == 0) {
+            advance_i();
+            in_replay = argv[i];
+        } else if (std::strcmp(argv[i], "--extract") == 0) {
+            advance_i();
+            in_extract = argv[i];
+        } else if (std::strcmp(argv[i], "--pack") == 0) {
+            advance_i();
+            in_pack = argv[i];
+        } else if (std::strcmp(argv[i], "--export-tar") == 0) {
+            advance_i();
+            in_export_tar = argv[i];
+        } else if (std::strcmp(argv[i], "--import-tar") == 0) {
+            advance_i();
+            in_import_tar = argv[i];
+        } else if (std::strcmp(argv[i], "--check") == 0) {
+            advance_i();
+            in_check = argv[i];
+        } else if (std::strcmp(argv[i], "--jobs") == 0) {
+            advance_i();
+            jobs = (unsigned)std::strtoul(argv[i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "--format") == 0) {
+            format = true;
+        } else if (std::strcmp(argv[i], "--block-size") == 0) {
+            advance_i();
+            format_params.block_size = (u32)std::strtoul(argv[i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "--blocks") == 0) {
+            advance_i();
+            format_params.block_count = (u32)std::strtoul(argv[i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "--max-dirs") == 0) {
+            advance_i();
+            format_params.max_dirs = (u32)std::strtoul(argv[i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "--max-files") == 0) {
+            advance_i();
+            format_params.max_files = (u32)std::strtoul(argv[i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "--dir-buckets") == 0) {
+            advance_i();
+            format_params.dir_buckets = (u32)std::strtoul(argv[i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "--file-buckets") == 0) {
+            advance_i();
+            format_params.file_buckets = (u32)std::strtoul(argv[i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "--two-partitions") == 0) {
+            format_params.two_partitions = true;
+        } else if (std::strcmp(argv[i], "--external-l4") == 0) {
+            format_params.external_ivfc_l4 = true;
         } else if (std::strcmp(argv[i], "--const") == 0) {
             advance_i();
             auto c = OpenDiskFile(argv[i]);
@@ -379,21 +956,78 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    std::FILE* tar_out = in_export_tar ? OpenOutput(in_export_tar) : nullptr;
+    std::FILE* check_out = in_check ? OpenOutput(in_check) : nullptr;
+    if ((in_export_tar && !tar_out) || (in_check && !check_out))
+        return 1;
+
+    if (format) {
+        if (const char* error = CheckFormatParams(format_params)) {
+            puts(error);
+            exit(1);
+        }
+        auto image = FormatDisa(format_params);
+        CreateDiskFile(source_file, image.size())->Write(0, image);
+        std::printf("Formatted %s (0x%zX bytes)\n", source_file, image.size());
+        return 0;
+    }
+
+    // Without --id, every save is mounted, as its own directory.
+    bool all_saves = in_id == nullptr && (file_type == TypeSdSave || file_type == TypeNandSave);
+    if (all_saves && (check_out || in_pack || in_import_tar || in_memory || in_verify_cache)) {
+        puts("Need --id argument for --check, --pack, --import-tar, --in-memory and "
+             "--verify-cache.");
+        exit(1);
+    }
+
+    stats = std::make_shared<StatsRegistry>();
+
+    DisaOptions options;
+    options.lazy = lazy;
+    options.stats = stats;
+    if (cache_size != 0)
+        options.cache = std::make_shared<CacheBudget>(cache_size);
+    // A replay must not modify the image, so it runs on a copy-on-write view of it.
+    // Returns nullptr if `path` cannot be opened.
+    auto open_image = [in_replay](const char* path) -> std::shared_ptr<FileInterface> {
+        auto file = TryOpenDiskFile(path);
+        if (file && in_replay)
+            return std::make_shared<CowFile>(std::move(file));
+        return file;
+    };
+    auto open_verify_cache = [&](const std::string& image_path,
+                                 std::shared_ptr<FileInterface> container) {
+        // The cache would record blocks written by the replay as verified.
+        if (in_verify_cache && !in_replay) {
+            options.verify_cache =
+                std::make_shared<VerifyCache>(in_verify_cache, image_path, std::move(container));
+        }
+    };
+
+    std::shared_ptr<FileInterface> container;
+    std::string image_path;
+    std::unique_ptr<AesCmacBlockProvider> block_provider;
+    bytes cmac_key;
+    // Set instead of `container` when every save on the SD card or NAND is mounted.
+    std::unique_ptr<MultiSaveFs> multi_save;
     switch (file_type) {
     case TypeNone:
         puts("No file/directory type specified.");
         exit(1);
         break;
-    case TypeDisa:
+    case TypeDisa: {
         puts("Mounting as bare DISA file. After modification, you need to resign the CMAC header "
              "using other tools.");
-        interface = std::make_unique<Disa>(OpenDiskFile(source_file));
-        break;
-    case TypeSdSave: {
-        if (in_id == nullptr) {
-            puts("Need --id argument.");
+        container = open_image(source_file);
+        image_path = source_file;
+        if (!container) {
+            std::printf("Failed to open %s\n", image_path.c_str());
             exit(1);
         }
+        stats->Attach(*container, "disk", true);
+        break;
+    }
+    case TypeSdSave: {
         if (in_movable == nullptr) {
             puts("Need --movable argument.");
             exit(1);
@@ -406,56 +1040,65 @@ int main(int argc, char* argv[]) {
             puts("Need --const argument.");
             exit(1);
         }
-        u64 id = (u64)std::strtoll(in_id, nullptr, 16);
         auto key = LoadKeyFromMovable(in_movable);
         if (key.empty()) {
             puts("Failed to open movable.sed");
             exit(1);
         }
-        auto key_hash = HashMovableKey(key);
-        auto path = std::string(source_file) + "/Nintendo 3DS/" + key_hash;
-
-        DIR* d = opendir(path.data());
-        assert(d != nullptr);
-        dirent* dir;
-        while (true) {
-            dir = readdir(d);
-            assert(dir != nullptr);
-            if (std::strcmp(dir->d_name, ".") != 0 && std::strcmp(dir->d_name, "..") != 0)
-                break;
-        }
-        path += std::string("/") + dir->d_name;
-        std::string sub_path = "/title/" + IntToHex((u32)(id >> 32)) + "/" +
-                               IntToHex((u32)(id & 0xFFFFFFFF)) + "/data/00000001.sav";
-        path += sub_path;
-
-        bytes path_to_hash;
-        // TODO proper UTF-8 to UTF-16?
-        for (char c : sub_path) {
-            path_to_hash.push_back((byte)c);
-            path_to_hash.push_back(0);
+        auto id0_path = std::string(source_file) + "/Nintendo 3DS/" + HashMovableKey(key);
+        auto id1 = ListHostDir(id0_path);
+        if (id1.empty()) {
+            std::printf("No ID1 directory in %s\n", id0_path.c_str());
+            exit(1);
         }
+        auto id1_path = id0_path + "/" + id1[0];
+        bytes decrypt_key = ScrambleKey(key_x_dec, key, key_c);
+        cmac_key = ScrambleKey(key_x_sign, key, key_c);
+        auto open_save = [&open_image, id1_path, decrypt_key](
+                             u64 id, const std::string& label) -> std::shared_ptr<FileInterface> {
+            std::string sub_path = SdSavePath(id);
+            auto disk_file = open_image((id1_path + sub_path).c_str());
+            if (!disk_file)
+                return nullptr;
+            stats->Attach(*disk_file, label + "disk", true);
+            auto file = std::make_shared<AesCtrFile>(disk_file, decrypt_key, SdFileIv(sub_path));
+            stats->Attach(*file, label + "aes_ctr");
+            return file;
+        };
 
-        path_to_hash.push_back(0);
-        path_to_hash.push_back(0);
-
-        bytes iv = Crypto::Sha256(path_to_hash);
-        for (unsigned i = 0; i < 16; ++i) {
-            iv[i] ^= iv[i + 16];
+        if (in_id == nullptr) {
+            multi_save = std::make_unique<MultiSaveFs>();
+            for (const auto& high : ListHostDir(id1_path + "/title")) {
+                for (const auto& low : ListHostDir(id1_path + "/title/" + high)) {
+                    u64 id = std::strtoull((high + low).c_str(), nullptr, 16);
+                    if (IntToHex((u32)(id >> 32)) != high || IntToHex((u32)id) != low ||
+                        access((id1_path + SdSavePath(id)).c_str(), F_OK) != 0)
+                        continue;
+                    std::string label = "title/" + high + "/" + low + "/";
+                    auto open = [&options, open_save, cmac_key, id, label,
+                                 check = SaveCheck::Unchecked]() mutable {
+                        DisaOptions save_options = options;
+                        save_options.label_prefix = label;
+                        return OpenCheckedSave(open_save(id, label),
+                                               std::make_unique<CtrSignAesCmacBlock>(id), cmac_key,
+                                               save_options, check);
+                    };
+                    multi_save->AddSave({"title", high, low}, open);
+                }
+            }
+            break;
         }
-        iv.resize(16);
-
-        auto file = std::make_shared<AesCtrFile>(OpenDiskFile(path.data()),
-                                                 ScrambleKey(key_x_dec, key, key_c), iv);
-        interface = std::make_unique<Disa>(file, std::make_unique<CtrSignAesCmacBlock>(id),
-                                           ScrambleKey(key_x_sign, key, key_c));
+        u64 id = (u64)std::strtoll(in_id, nullptr, 16);
+        container = open_save(id, "");
+        image_path = id1_path + SdSavePath(id);
+        if (!container) {
+            std::printf("Failed to open %s\n", image_path.c_str());
+            exit(1);
+        }
+        block_provider = std::make_unique<CtrSignAesCmacBlock>(id);
         break;
     }
     case TypeNandSave: {
-        if (in_id == nullptr) {
-            puts("Need --id argument.");
-            exit(1);
-        }
         if (key_x_sign.empty()) {
             puts("Need --boot9 argument.");
             exit(1);
@@ -464,23 +1107,102 @@ int main(int argc, char* argv[]) {
             puts("Need --const argument.");
             exit(1);
         }
-        u32 id = (u32)std::strtol(in_id, nullptr, 16);
         auto key = LoadKeyFromMovable((std::string(source_file) + "/private/movable.sed").c_str());
         if (key.empty()) {
             puts("Failed to open movable.sed in NAND");
             exit(1);
         }
-        auto key_hash = HashMovableKey(key);
-        auto path = std::string(source_file) + "/data/" + key_hash + "/sysdata/" + IntToHex(id) +
-                    "/00000000";
+        auto sysdata_path = std::string(source_file) + "/data/" + HashMovableKey(key) + "/sysdata/";
+        cmac_key = ScrambleKey(key_x_sign, key, key_c);
 
-        interface = std::make_unique<Disa>(OpenDiskFile(path.data()),
-                                           std::make_unique<NandSaveAesCmacBlock>(id),
-                                           ScrambleKey(key_x_sign, key, key_c));
+        if (in_id == nullptr) {
+            multi_save = std::make_unique<MultiSaveFs>();
+            for (const auto& name : ListHostDir(sysdata_path)) {
+                u32 id = (u32)std::strtoul(name.c_str(), nullptr, 16);
+                std::string path = sysdata_path + name + "/00000000";
+                if (IntToHex(id) != name || access(path.c_str(), F_OK) != 0)
+                    continue;
+                std::string label = "sysdata/" + name + "/";
+                auto open = [&options, &open_image, cmac_key, id, path, label,
+                             check = SaveCheck::Unchecked]() mutable {
+                    DisaOptions save_options = options;
+                    save_options.label_prefix = label;
+                    auto disk_file = open_image(path.c_str());
+                    if (disk_file)
+                        stats->Attach(*disk_file, label + "disk", true);
+                    return OpenCheckedSave(disk_file, std::make_unique<NandSaveAesCmacBlock>(id),
+                                           cmac_key, save_options, check);
+                };
+                multi_save->AddSave({"sysdata", name}, open);
+            }
+            break;
+        }
+        u32 id = (u32)std::strtol(in_id, nullptr, 16);
+        auto path = sysdata_path + IntToHex(id) + "/00000000";
+
+        container = open_image(path.data());
+        image_path = path;
+        if (!container) {
+            std::printf("Failed to open %s\n", image_path.c_str());
+            exit(1);
+        }
+        stats->Attach(*container, "disk", true);
+        block_provider = std::make_unique<NandSaveAesCmacBlock>(id);
         break;
     }
     }
 
+    if (check_out) {
+        ThreadPool pool(jobs > 1 ? jobs - 1 : 0);
+        CheckReport report = CheckDisa(container, block_provider.get(), cmac_key, pool);
+        std::string json = report.ToJson(image_path);
+        bool written = std::fputs(json.c_str(), check_out) >= 0;
+        if (std::fclose(check_out) != 0 || !written)
+            return 1;
+        return report.IsClean() ? 0 : 2;
+    }
+
+    if (in_memory) {
+        ram_image = std::make_shared<CachedFile>(container);
+        stats->Attach(*ram_image, "ram");
+        container = ram_image;
+    }
+    if (multi_save) {
+        std::printf("Found %zu saves\n", multi_save->GetSaveCount());
+        interface = std::move(multi_save);
+    } else {
+        open_verify_cache(image_path, container);
+        interface = std::make_unique<Disa>(container, std::move(block_provider), cmac_key, options);
+    }
+
+    if (in_extract || in_pack || in_export_tar || in_import_tar) {
+        bool ok;
+        if (in_extract) {
+            ok = ExtractTree(*interface, in_extract, jobs);
+        } else if (in_pack) {
+            ok = PackTree(static_cast<Disa&>(*interface), in_pack, jobs);
+        } else if (in_export_tar) {
+            ok = tar_out && ExportTar(*interface, tar_out);
+            if (tar_out && std::fclose(tar_out) != 0)
+                ok = false;
+        } else {
+            std::FILE* in = std::strcmp(in_import_tar, "-") == 0
+                                ? stdin
+                                : std::fopen(in_import_tar, "rb");
+            ok = in && ImportTar(static_cast<Disa&>(*interface), in);
+            if (in && in != stdin)
+                std::fclose(in);
+        }
+        interface.reset();
+        if (ram_image)
+            ram_image->Flush();
+        IoTrace::Close();
+        Trace::Close();
+        if (options.verify_cache)
+            options.verify_cache->Save();
+        return ok ? 0 : 1;
+    }
+
     static fuse_operations op;
     op.getattr = FuseCallback::getattr;
     op.readdir = FuseCallback::readdir;
@@ -492,7 +1214,28 @@ int main(int argc, char* argv[]) {
     op.open = FuseCallback::open;
     op.read = FuseCallback::read;
     op.write = FuseCallback::write;
+    op.flush = FuseCallback::flush;
+    op.fsync = FuseCallback::fsync;
     // op.truncate = FuseCallback::truncate;
     op.release = FuseCallback::release;
-    return fuse_main((int)fuse_argv.size(), fuse_argv.data(), &op);
+    op.init = FuseCallback::init;
+
+    if (in_replay) {
+        int result = Replay(in_replay);
+        interface.reset();
+        IoTrace::Close();
+        Trace::Close();
+        return result;
+    }
+
+    int result = fuse_main((int)fuse_argv.size(), fuse_argv.data(), &op);
+
+    interface.reset();
+    if (ram_image)
+        ram_image->Flush();
+    IoTrace::Close();
+    Trace::Close();
+    if (options.verify_cache)
+        options.verify_cache->Save();
+    return result;
 }
@@ -0,0 +1,144 @@
+#include <algorithm>
+#include "memory_file.h"
+
+MemoryFile::MemoryFile(std::size_t size) : FileInterface(size), data(size, 0) {}
+
+MemoryFile::MemoryFile(bytes data_) : FileInterface(data_.size()), data(std::move(data_)) {}
+
+const bytes& MemoryFile::GetData() const {
+    return data;
+}
+
+bytes MemoryFile::ReadImpl(std::size_t offset, std::size_t size) {
+    return bytes(data.begin() + offset, data.begin() + offset + size);
+}
+
+void MemoryFile::ReadIntoImpl(std::size_t offset, std::size_t size, u8* dst) {
+    std::memcpy(dst, data.data() + offset, size);
+}
+
+void MemoryFile::WriteFromImpl(std::size_t offset, std::size_t size, const u8* src) {
+    std::memcpy(data.data() + offset, src, size);
+}
+
+CowFile::CowFile(std::shared_ptr<FileInterface> base_, std::size_t page_size_)
+    : FileInterface(base_->file_size), base(std::move(base_)), page_size(page_size_) {}
+
+void CowFile::Commit() {
+    auto page = pages.begin();
+    while (page != pages.end()) {
+        // Coalesce consecutive pages into one write.
+        std::size_t offset = page->first * page_size;
+        bytes run = std::move(page->second);
+        std::size_t next_index = page->first + 1;
+        for (++page; page != pages.end() && page->first == next_index; ++page, ++next_index) {
+            run += page->second;
+        }
+        base->Write(offset, run);
+    }
+    pages.clear();
+}
+
+void CowFile::Discard() {
+    pages.clear();
+}
+
+std::size_t CowFile::GetDirtyPageCount() const {
+    return pages.size();
+}
+
+bytes CowFile::ReadImpl(std::size_t offset, std::size_t size) {
+    bytes result(size);
+    std::size_t end = offset + size;
+    std::size_t cur = offset;
+    while (cur < end) {
+        std::size_t page = cur / page_size;
+        auto dirty = pages.lower_bound(page);
+        if (dirty != pages.end() && dirty->first == page) {
+            std::size_t copy_end = std::min((page + 1) * page_size, end);
+            auto begin = dirty->second.begin() + (cur - page * page_size);
+            std::copy(begin, begin + (copy_end - cur), result.begin() + (cur - offset));
+            cur = copy_end;
+            continue;
+        }
+
+        // Read the clean pages up to the next dirty one from `base` at once.
+        std::size_t clean_end = end;
+        if (dirty != pages.end())
+            clean_end = std::min(clean_end, dirty->first * page_size);
+        auto clean = base->Read(cur, clean_end - cur);
+        std::copy(clean.begin(), clean.end(), result.begin() + (cur - offset));
+        cur = clean_end;
+    }
+    return result;
+}
+
+void CowFile::WriteImpl(std::size_t offset, const bytes& data) {
+    std::size_t end = offset + data.size();
+    std::size_t cur = offset;
+    while (cur < end) {
+        std::size_t page = cur / page_size;
+        std::size_t copy_end = std::min((page + 1) * page_size, end);
+        auto begin = data.begin() + (cur - offset);
+        bytes& target = GetPage(page);
+        std::copy(begin, begin + (copy_end - cur), target.begin() + (cur - page * page_size));
+        cur = copy_end;
+    }
+}
+
+bytes& CowFile::GetPage(std::size_t page) {
+    auto found = pages.find(page);
+    if (found != pages.end())
+        return found->second;
+    std::size_t offset = page * page_size;
+    return pages[page] = base->Read(offset, std::min(page_size, file_size - offset));
+}
+
+CachedFile::CachedFile(std::shared_ptr<FileInterface> base_, std::size_t page_size_)
+    : FileInterface(base_->file_size), base(std::move(base_)), page_size(page_size_),
+      data(base->Read(0, base->file_size)), dirty((file_size + page_size - 1) / page_size) {}
+
+void CachedFile::Flush() {
+    std::size_t page = 0;
+    while (page < dirty.size()) {
+        if (!dirty[page]) {
+            ++page;
+            continue;
+        }
+        // Coalesce consecutive dirty pages into one write.
+        std::size_t end = page;
+        while (end < dirty.size() && dirty[end])
+            dirty[end++] = false;
+        std::size_t offset = page * page_size;
+        std::size_t run_end = std::min(end * page_size, file_size);
+        base->Write(offset, run_end - offset, data.data() + offset);
+        page = end;
+    }
+    dirty_count = 0;
+}
+
+std::size_t CachedFile::GetDirtyPageCount() const {
+    return dirty_count;
+}
+
+bytes CachedFile::ReadImpl(std::size_t offset, std::size_t size) {
+    return bytes(data.begin() + offset, data.begin() + offset + size);
+}
+
+void CachedFile::ReadIntoImpl(std::size_t offset, std::size_t size, u8* dst) {
+    std::memcpy(dst, data.data() + offset, size);
+}
+
+void CachedFile::WriteFromImpl(std::size_t offset, std::size_t size, const u8* src) {
+    std::memcpy(data.data() + offset, src, size);
+    for (std::size_t page = offset / page_size; page * page_size < offset + size; ++page) {
+        if (!dirty[page]) {
+            dirty[page] = true;
+            ++dirty_count;
+        }
+    }
+}
+
+std::shared_ptr<MemoryFile> LoadMemoryFile(FileInterface& file) {
+    return std::make_shared<MemoryFile>(file.Read(0, file.file_size));
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <vector>
+#include "file_interface.h"
+
+// A file held entirely in RAM.
+class MemoryFile final : public FileInterface {
+public:
+    MemoryFile(std::size_t size);
+    MemoryFile(bytes data_);
+
+    const bytes& GetData() const;
+
+protected:
+    bytes ReadImpl(std::size_t offset, std::size_t size) override;
+    void ReadIntoImpl(std::size_t offset, std::size_t size, u8* dst) override;
+    void WriteFromImpl(std::size_t offset, std::size_t size, const u8* src) override;
+
+private:
+    bytes data;
+};
+
+// A copy-on-write view of `base`. Written pages are kept in RAM and shadow `base` until they are
+// written back by Commit() or dropped by Discard(); `base` itself is only ever read before that.
+class CowFile final : public FileInterface {
+public:
+    CowFile(std::shared_ptr<FileInterface> base_, std::size_t page_size_ = 0x1000);
+
+    void Commit();
+    void Discard();
+    std::size_t GetDirtyPageCount() const;
+
+protected:
+    bytes ReadImpl(std::size_t offset, std::size_t size) override;
+    void WriteImpl(std::size_t offset, const bytes& data) override;
+
+private:
+    std::shared_ptr<FileInterface> base;
+    const std::size_t page_size;
+    std::map<std::size_t, bytes> pages;
+
+    bytes& GetPage(std::size_t page);
+};
+
+// All of `base`, read into RAM on construction. Writes only go to RAM until Flush() writes the
+// pages changed since the last flush back to `base`.
+class CachedFile final : public FileInterface {
+public:
+    CachedFile(std::shared_ptr<FileInterface> base_, std::size_t page_size_ = 0x1000);
+
+    void Flush();
+    std::size_t GetDirtyPageCount() const;
+
+protected:
+    bytes ReadImpl(std::size_t offset, std::size_t size) override;
+    void ReadIntoImpl(std::size_t offset, std::size_t size, u8* dst) override;
+    void WriteFromImpl(std::size_t offset, std::size_t size, const u8* src) override;
+
+private:
+    std::shared_ptr<FileInterface> base;
+    const std::size_t page_size;
+    bytes data;
+    std::vector<bool> dirty;
+    std::size_t dirty_count = 0;
+};
+
+// Reads all of `file` into a new MemoryFile.
+std::shared_ptr<MemoryFile> LoadMemoryFile(FileInterface& file);
@@ -1,5 +1,17 @@
 #include "metadata_table.h"
 
+u32 GetMetadataBucket(const FsName& name, u32 parent, u32 bucket_count) {
+    u32 hash = parent ^ 0x091A2B3C;
+    for (int i = 0; i < 4; ++i) {
+        hash = (hash >> 1) | (hash << 31);
+        hash ^= (u32)name[i * 4];
+        hash ^= (u32)name[i * 4 + 1] << 8;
+        hash ^= (u32)name[i * 4 + 2] << 16;
+        hash ^= (u32)name[i * 4 + 3] << 24;
+    }
+    return hash % bucket_count;
+}
+
 #define DEFINE_ENTRY_FIELD(name, type, offset)                                                     \
     type Get##name(u32 index) {                                                                    \
         return Decode<type>(entry_table->Read(EntrySize * index + (offset), sizeof(type)));        \
@@ -30,6 +42,16 @@ public:
         return 0;
     }
 
+    // Entries that can still be added: never used ones, and freed ones on the dummy chain.
+    u32 GetFreeCount() {
+        u32 max_count = GetMaxCount(0);
+        u32 count = max_count - GetCurrentCount(0);
+        for (u32 index = GetNextDummy(0); index != 0 && count < max_count;
+             index = GetNextDummy(index))
+            ++count;
+        return count;
+    }
+
 protected:
     static constexpr std::size_t EntrySize = EntrySize_;
     DEFINE_ENTRY_FIELD(Parent, u32, 0x0)
@@ -86,15 +108,7 @@ private:
     DEFINE_ENTRY_FIELD(NextDummy, u32, EntrySize - 4)
 
     u32 GetHashTableBucket(const FsName& name, u32 parent) {
-        u32 hash = parent ^ 0x091A2B3C;
-        for (int i = 0; i < 4; ++i) {
-            hash = (hash >> 1) | (hash << 31);
-            hash ^= (u32)name[i * 4];
-            hash ^= (u32)name[i * 4 + 1] << 8;
-            hash ^= (u32)name[i * 4 + 2] << 16;
-            hash ^= (u32)name[i * 4 + 3] << 24;
-        }
-        return hash % hash_table_size;
+        return GetMetadataBucket(name, parent, hash_table_size);
     }
 
     u32 GetBucketValue(u32 bucket) {
@@ -322,6 +336,14 @@ FsStat FsMetadata::Find(const char* path) {
     return s;
 }
 
+u32 FsMetadata::GetFreeDirCount() {
+    return directories->GetFreeCount();
+}
+
+u32 FsMetadata::GetFreeFileCount() {
+    return files->GetFreeCount();
+}
+
 u32 FsMetadata::MakeDir(const FsName& name, u32 parent) {
     return directories->Add(name, parent);
 }
@@ -6,6 +6,9 @@
 #include "file_interface.h"
 #include "fs_interface.h"
 
+// Hash table bucket of the entry named `name` in directory `parent`.
+u32 GetMetadataBucket(const FsName& name, u32 parent, u32 bucket_count);
+
 class DirectoryTable;
 class FileTable;
 
@@ -30,6 +33,10 @@ public:
     u32 GetFileBlockIndex(u32 index);
     void SetFileBlockIndex(u32 index, u32 block);
 
+    // Directories and files that MakeDir() and MakeFile() can still create.
+    u32 GetFreeDirCount();
+    u32 GetFreeFileCount();
+
 private:
     std::unique_ptr<DirectoryTable> directories;
     std::unique_ptr<FileTable> files;
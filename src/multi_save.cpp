@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include "multi_save.h"
+
+static FsName StringToName(const std::string& str) {
+    assert(str.size() <= 16);
+    FsName name{};
+    std::copy(str.begin(), str.end(), name.begin());
+    return name;
+}
+
+// A file of a save, which keeps the save from being closed until the file is.
+class MultiSaveFs::SaveFile final : public FsFileInterface {
+public:
+    SaveFile(MultiSaveFs& fs_, u32 save_, FsFileInterface* file_)
+        : fs(fs_), save(save_), file(file_) {
+        ++fs.saves[save - 1].open_files;
+    }
+    std::size_t Read(std::size_t offset, std::size_t size, u8* buf) override {
+        return file->Read(offset, size, buf);
+    }
+    std::size_t Write(std::size_t offset, std::size_t size, const u8* buf) override {
+        return file->Write(offset, size, buf);
+    }
+    std::size_t GetSize() override {
+        return file->GetSize();
+    }
+    std::size_t SetSize(std::size_t size) override {
+        return file->SetSize(size);
+    }
+    void Flush() override {
+        file->Flush();
+    }
+    void Close() override {
+        file->Close();
+        --fs.saves[save - 1].open_files;
+        delete this;
+    }
+
+private:
+    MultiSaveFs& fs;
+    u32 save;
+    FsFileInterface* file;
+};
+
+MultiSaveFs::MultiSaveFs() : nodes(1), entries(1) {
+    nodes[0].name = {};
+    nodes[0].parent = 0;
+    entries[0] = {0, false, 0};
+    u32 root = GetIndex(0, false, 0);
+    assert(root == 1);
+}
+
+void MultiSaveFs::AddSave(const std::vector<std::string>& path, Opener open) {
+    assert(!path.empty());
+    u32 node = 0;
+    for (const std::string& step : path) {
+        assert(nodes[node].save == 0);
+        FsName name = StringToName(step);
+        auto& children = nodes[node].children;
+        auto child = std::find_if(children.begin(), children.end(),
+                                  [&](u32 child) { return nodes[child].name == name; });
+        if (child != children.end()) {
+            node = *child;
+            continue;
+        }
+        Node new_node;
+        new_node.name = name;
+        new_node.parent = node;
+        nodes.push_back(std::move(new_node));
+        nodes[node].children.push_back((u32)nodes.size() - 1);
+        node = (u32)nodes.size() - 1;
+    }
+    assert(nodes[node].save == 0 && nodes[node].children.empty());
+    saves.push_back({std::move(open), nullptr});
+    nodes[node].save = (u32)saves.size();
+}
+
+std::size_t MultiSaveFs::GetSaveCount() const {
+    return saves.size();
+}
+
+FsStat MultiSaveFs::Find(const char* path) {
+    FsStat s;
+    s.parent = 0;
+    s.index = 1;
+    s.result = FsResult::DirExists;
+    s.name = {};
+    FsPath parsed(path);
+    if (!parsed.is_valid) {
+        s.result = FsResult::InvalidPath;
+        return s;
+    }
+
+    u32 node = 0;
+    auto step = parsed.steps.begin();
+    for (; step != parsed.steps.end() && nodes[node].save == 0; ++step) {
+        s.parent = s.index;
+        s.name = *step;
+        const auto& children = nodes[node].children;
+        auto child = std::find_if(children.begin(), children.end(),
+                                  [&](u32 child) { return nodes[child].name == *step; });
+        if (child == children.end()) {
+            s.index = 0;
+            s.result = std::next(step) == parsed.steps.end() ? FsResult::NotFound
+                                                              : FsResult::PathNotFound;
+            return s;
+        }
+        node = *child;
+        s.index = GetIndex(0, false, node);
+    }
+    u32 save = nodes[node].save;
+    if (save == 0)
+        return s;
+
+    // The rest of the path is in the save, whose root directory stands in for `node`.
+    std::string rest;
+    for (; step != parsed.steps.end(); ++step)
+        rest += "/" + NameToString(*step);
+    FsInterface* save_fs = GetSave(save);
+    if (!save_fs) {
+        s.result = FsResult::IoError;
+        s.index = 0;
+        return s;
+    }
+    FsStat found = save_fs->Find(rest.empty() ? "/" : rest.c_str());
+    s.result = found.result;
+    if (found.parent != 0) {
+        s.parent = GetIndex(save, false, found.parent);
+        s.name = found.name;
+    }
+    bool is_file = found.result == FsResult::FileExists || found.result == FsResult::FileInPath;
+    s.index = found.index == 0 ? 0 : GetIndex(save, is_file, found.index);
+    return s;
+}
+
+u32 MultiSaveFs::MakeDir(const FsName& name, u32 parent) {
+    Entry entry = GetEntry(parent);
+    FsInterface* save_fs = entry.save == 0 ? nullptr : GetSave(entry.save);
+    if (!save_fs)
+        return 0;
+    u32 index = save_fs->MakeDir(name, entry.index);
+    return index == 0 ? 0 : GetIndex(entry.save, false, index);
+}
+
+u32 MultiSaveFs::MakeFile(const FsName& name, u32 parent) {
+    Entry entry = GetEntry(parent);
+    FsInterface* save_fs = entry.save == 0 ? nullptr : GetSave(entry.save);
+    if (!save_fs)
+        return 0;
+    u32 index = save_fs->MakeFile(name, entry.index);
+    return index == 0 ? 0 : GetIndex(entry.save, true, index);
+}
+
+bool MultiSaveFs::RemoveDir(u32 index) {
+    Entry entry = GetEntry(index);
+    FsInterface* save_fs = entry.save == 0 || entry.index == 1 ? nullptr : GetSave(entry.save);
+    return save_fs && save_fs->RemoveDir(entry.index);
+}
+
+void MultiSaveFs::RemoveFile(u32 index) {
+    Entry entry = GetEntry(index);
+    assert(entry.save != 0);
+    if (FsInterface* save_fs = GetSave(entry.save))
+        save_fs->RemoveFile(entry.index);
+}
+
+void MultiSaveFs::MoveDir(u32 index, const FsName& name, u32 parent) {
+    assert(CanMove(index, parent));
+    Entry entry = GetEntry(index);
+    if (FsInterface* save_fs = GetSave(entry.save))
+        save_fs->MoveDir(entry.index, name, GetEntry(parent).index);
+}
+
+void MultiSaveFs::MoveFile(u32 index, const FsName& name, u32 parent) {
+    assert(CanMove(index, parent));
+    Entry entry = GetEntry(index);
+    if (FsInterface* save_fs = GetSave(entry.save))
+        save_fs->MoveFile(entry.index, name, GetEntry(parent).index);
+}
+
+bool MultiSaveFs::CanMove(u32 index, u32 parent) {
+    Entry entry = GetEntry(index);
+    return entry.save != 0 && entry.save == GetEntry(parent).save &&
+           (entry.is_file || entry.index != 1);
+}
+
+bool MultiSaveFs::IsReadOnly(u32 index) {
+    return GetEntry(index).save == 0;
+}
+
+std::vector<FsName> MultiSaveFs::ListSubDir(u32 index) {
+    Entry entry = GetEntry(index);
+    if (entry.save != 0) {
+        FsInterface* save_fs = GetSave(entry.save);
+        return save_fs ? save_fs->ListSubDir(entry.index) : std::vector<FsName>{};
+    }
+    std::vector<FsName> names;
+    for (u32 child : nodes[entry.index].children)
+        names.push_back(nodes[child].name);
+    return names;
+}
+
+std::vector<FsName> MultiSaveFs::ListSubFile(u32 index) {
+    Entry entry = GetEntry(index);
+    FsInterface* save_fs = entry.save == 0 ? nullptr : GetSave(entry.save);
+    if (!save_fs)
+        return {};
+    return save_fs->ListSubFile(entry.index);
+}
+
+u64 MultiSaveFs::GetFileSize(u32 index) {
+    Entry entry = GetEntry(index);
+    FsInterface* save_fs = GetSave(entry.save);
+    return save_fs ? save_fs->GetFileSize(entry.index) : 0;
+}
+
+FsFileInterface* MultiSaveFs::Open(u32 index) {
+    Entry entry = GetEntry(index);
+    FsInterface* save_fs = GetSave(entry.save);
+    if (!save_fs)
+        return nullptr;
+    return new SaveFile(*this, entry.save, save_fs->Open(entry.index));
+}
+
+u32 MultiSaveFs::GetIndex(u32 save, bool is_file, u32 index) {
+    u64 key = (u64)save << 33 | (u64)is_file << 32 | index;
+    auto found = entry_indices.find(key);
+    if (found != entry_indices.end())
+        return found->second;
+    entries.push_back({save, is_file, index});
+    u32 result = (u32)entries.size() - 1;
+    entry_indices.emplace(key, result);
+    return result;
+}
+
+MultiSaveFs::Entry MultiSaveFs::GetEntry(u32 index) const {
+    assert(index != 0 && index < entries.size());
+    return entries[index];
+}
+
+FsInterface* MultiSaveFs::GetSave(u32 save) {
+    Save& entry = saves[save - 1];
+    entry.last_used = ++use_count;
+    if (!entry.fs) {
+        if (open_save_count >= MaxOpenSaves)
+            CloseIdleSave();
+        entry.fs = entry.open();
+        if (entry.fs)
+            ++open_save_count;
+    }
+    return entry.fs.get();
+}
+
+// If every open save has open files, none is closed, and the cap is exceeded until they are.
+void MultiSaveFs::CloseIdleSave() {
+    Save* victim = nullptr;
+    for (Save& save : saves) {
+        if (save.fs && save.open_files == 0 && (!victim || save.last_used < victim->last_used))
+            victim = &save;
+    }
+    if (victim) {
+        victim->fs.reset();
+        --open_save_count;
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "fs_interface.h"
+
+// Several saves in one tree, each as a directory at the path it is added with, under directories
+// that IsReadOnly(). A save is opened the first time a path in it is looked up. Lookups in a save
+// that cannot be opened give FsResult::IoError, and Open() then returns nullptr.
+//
+// Each open save holds a host file, so at most MaxOpenSaves are kept open. The least recently used
+// save without open files is closed to make room, and opened again when it is next used.
+//
+// Indices of entries in a save are only unique within the save, so the indices handed out here
+// are numbers assigned to (save, kind, index) on first use. A save's own indices come from its
+// tables, so they stay valid when it is closed and opened again.
+class MultiSaveFs : public FsInterface {
+public:
+    // Returns nullptr if the save cannot be opened.
+    using Opener = std::function<std::unique_ptr<FsInterface>()>;
+
+    static constexpr std::size_t MaxOpenSaves = 256;
+
+    MultiSaveFs();
+
+    // Adds the save opened by `open` as the directory `path`, e.g. {"title", "00040000",
+    // "00055d00"}. `path` must not be in or above another save.
+    void AddSave(const std::vector<std::string>& path, Opener open);
+    std::size_t GetSaveCount() const;
+
+    FsStat Find(const char* path) override;
+    u32 MakeDir(const FsName& name, u32 parent) override;
+    u32 MakeFile(const FsName& name, u32 parent) override;
+    bool RemoveDir(u32 index) override;
+    void RemoveFile(u32 index) override;
+    void MoveDir(u32 index, const FsName& name, u32 parent) override;
+    void MoveFile(u32 index, const FsName& name, u32 parent) override;
+    bool CanMove(u32 index, u32 parent) override;
+    bool IsReadOnly(u32 index) override;
+    std::vector<FsName> ListSubDir(u32 index) override;
+    std::vector<FsName> ListSubFile(u32 index) override;
+    u64 GetFileSize(u32 index) override;
+    FsFileInterface* Open(u32 index) override;
+
+private:
+    // A directory above the saves.
+    struct Node {
+        FsName name;
+        u32 parent;
+        std::vector<u32> children;
+        u32 save = 0; // 1 + index in `saves` if the node is a save; its children are then unused
+    };
+    struct Save {
+        Opener open;
+        std::unique_ptr<FsInterface> fs;
+        unsigned open_files = 0;
+        u64 last_used = 0;
+    };
+    class SaveFile;
+    // What an index handed out here stands for. Nodes are directories with `save` 0.
+    struct Entry {
+        u32 save;
+        bool is_file;
+        u32 index;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<Save> saves;
+    std::vector<Entry> entries;
+    std::unordered_map<u64, u32> entry_indices;
+    std::size_t open_save_count = 0;
+    u64 use_count = 0;
+
+    u32 GetIndex(u32 save, bool is_file, u32 index);
+    Entry GetEntry(u32 index) const;
+    // Returns nullptr if the save cannot be opened.
+    FsInterface* GetSave(u32 save);
+    void CloseIdleSave();
+};
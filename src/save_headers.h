@@ -0,0 +1,122 @@
+#pragma once
+
+#include "common_types.h"
+
+// On-disk headers of a DISA save image, in the host byte order like the rest of the code. Each is
+// read or written as a whole with one copy.
+
+#pragma pack(push, 1)
+
+struct ByteRange {
+    u64 offset;
+    u64 size;
+};
+
+// At 0x100 in the image, signed by the CMAC at 0x0.
+struct DisaHeader {
+    static constexpr u32 Magic = 0x41534944; // "DISA"
+    static constexpr u32 Version = 0x00040000;
+
+    u32 magic;
+    u32 version;
+    u64 partition_count;
+    u64 table_sec_offset;
+    u64 table_pri_offset;
+    u64 table_size;
+    ByteRange partition_entry[2]; // DIFI descriptors, within the partition table
+    ByteRange partition[2];
+    u8 active_table;
+    u8 padding[3];
+};
+static_assert(sizeof(DisaHeader) == 0x6C, "DISA header size");
+
+// Start of a partition descriptor, followed by its IVFC and DPFS descriptors and master hash.
+struct DifiHeader {
+    static constexpr u32 Magic = 0x49464944; // "DIFI"
+    static constexpr u32 Version = 0x00010000;
+
+    u32 magic;
+    u32 version;
+    ByteRange ivfc_desc;
+    ByteRange dpfs_desc;
+    ByteRange master_hash;
+    u8 external_ivfc_l4;
+    u8 dpfs_selector;
+    u16 padding;
+    u64 ivfc_l4_offset; // in the partition, if external_ivfc_l4
+};
+static_assert(sizeof(DifiHeader) == 0x44, "DIFI header size");
+
+struct LevelDescriptor {
+    u64 offset;
+    u64 size;
+    u64 log2_block_size;
+};
+
+struct IvfcDescriptor {
+    static constexpr u32 Magic = 0x43465649; // "IVFC"
+    static constexpr u32 Version = 0x00020000;
+
+    u32 magic;
+    u32 version;
+    u64 master_hash_size;
+    LevelDescriptor levels[4];
+    u64 descriptor_size;
+};
+static_assert(sizeof(IvfcDescriptor) == 0x78, "IVFC descriptor size");
+
+struct DpfsDescriptor {
+    static constexpr u32 Magic = 0x53465044; // "DPFS"
+    static constexpr u32 Version = 0x00010000;
+
+    u32 magic;
+    u32 version;
+    LevelDescriptor levels[3];
+};
+static_assert(sizeof(DpfsDescriptor) == 0x50, "DPFS descriptor size");
+
+// Where a directory or file entry table is: an offset in the save partition when there is a
+// separate data partition, or a FAT chain in the data region otherwise.
+union TableLocation {
+    u64 offset;
+    struct {
+        u32 start_block;
+        u32 block_count;
+    } chain;
+};
+
+// At the start of the save partition.
+struct SaveHeader {
+    static constexpr u32 Magic = 0x45564153; // "SAVE"
+    static constexpr u32 Version = 0x00040000;
+
+    u32 magic;
+    u32 version;
+    u64 fs_info_offset;
+    u64 image_block_count;
+    u32 image_block_size;
+    u32 padding0;
+    u32 unknown;
+    u32 block_size;
+    u64 dir_hash_offset;
+    u32 dir_buckets;
+    u32 padding1;
+    u64 file_hash_offset;
+    u32 file_buckets;
+    u32 padding2;
+    u64 fat_offset;
+    u32 fat_size;
+    u32 padding3;
+    u64 data_region_offset;
+    u32 data_block_count;
+    u32 padding4;
+    TableLocation dir_table;
+    u32 max_dirs;
+    u32 padding5;
+    TableLocation file_table;
+    u32 max_files;
+    u32 padding6;
+};
+static_assert(sizeof(SaveHeader) == 0x88, "SAVE header size");
+
+#pragma pack(pop)
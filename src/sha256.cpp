@@ -0,0 +1,311 @@
+#include <atomic>
+#include <cstring>
+#include <openssl/sha.h>
+#include "crypto.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA256_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace Crypto {
+
+static const u32 K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const u32 InitialState[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+// Builds the padded final one or two 64-byte blocks of a message of `size` bytes whose last
+// `size % 64` bytes are `rest`. Returns the number of blocks written to `tail`.
+static std::size_t MakeTail(const u8* rest, std::size_t size, u8 tail[128]) {
+    std::size_t rest_size = size % 64;
+    std::size_t tail_blocks = rest_size < 56 ? 1 : 2;
+    std::memset(tail, 0, 128);
+    std::memcpy(tail, rest, rest_size);
+    tail[rest_size] = 0x80;
+    u64 bits = (u64)size * 8;
+    for (unsigned i = 0; i < 8; ++i) {
+        tail[tail_blocks * 64 - 1 - i] = (u8)(bits >> (i * 8));
+    }
+    return tail_blocks;
+}
+
+static void StoreDigest(const u32 state[8], u8* out) {
+    for (unsigned i = 0; i < 8; ++i) {
+        out[i * 4] = (u8)(state[i] >> 24);
+        out[i * 4 + 1] = (u8)(state[i] >> 16);
+        out[i * 4 + 2] = (u8)(state[i] >> 8);
+        out[i * 4 + 3] = (u8)state[i];
+    }
+}
+
+static void Sha256Scalar(const u8* data, std::size_t size, u8* out) {
+    SHA256(data, size, out);
+}
+
+#ifdef SHA256_X86
+
+__attribute__((target("sha,sse4.1"))) static void CompressShaNi(u32 state[8], const u8* data,
+                                                                 std::size_t blocks) {
+    const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);  // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);       // CDGH
+
+    for (; blocks != 0; --blocks, data += 64) {
+        __m128i abef_save = state0;
+        __m128i cdgh_save = state1;
+        __m128i w[4];
+        for (unsigned group = 0; group < 16; ++group) {
+            __m128i& current = w[group % 4];
+            if (group < 4) {
+                current = _mm_shuffle_epi8(
+                    _mm_loadu_si128((const __m128i*)(data + group * 16)), byte_swap);
+            } else {
+                __m128i schedule = _mm_sha256msg1_epu32(current, w[(group + 1) % 4]);
+                schedule = _mm_add_epi32(
+                    schedule, _mm_alignr_epi8(w[(group + 3) % 4], w[(group + 2) % 4], 4));
+                current = _mm_sha256msg2_epu32(schedule, w[(group + 3) % 4]);
+            }
+            __m128i message =
+                _mm_add_epi32(current, _mm_loadu_si128((const __m128i*)&K[group * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, message);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(message, 0x0E));
+        }
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);             // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);          // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);       // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);          // HGFE
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+
+static void Sha256ShaNi(const u8* data, std::size_t size, u8* out) {
+    u32 state[8];
+    std::memcpy(state, InitialState, sizeof(state));
+    CompressShaNi(state, data, size / 64);
+    u8 tail[128];
+    std::size_t tail_blocks = MakeTail(data + size - size % 64, size, tail);
+    CompressShaNi(state, tail, tail_blocks);
+    StoreDigest(state, out);
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i Rotr(__m256i x, int n) {
+    return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+// Transposes eight rows of eight 32-bit words in place.
+AVX2 static inline void Transpose8(__m256i r[8]) {
+    __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]), t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+    __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]), t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+    __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]), t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+    __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]), t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+    __m256i u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2);
+    __m256i u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3);
+    __m256i u4 = _mm256_unpacklo_epi64(t4, t6), u5 = _mm256_unpackhi_epi64(t4, t6);
+    __m256i u6 = _mm256_unpacklo_epi64(t5, t7), u7 = _mm256_unpackhi_epi64(t5, t7);
+    r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+    r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+    r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+    r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+    r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+    r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+    r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+    r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+// Runs `blocks` 64-byte blocks of eight independent messages through the compression function.
+// state[i] holds word i of all eight lanes.
+AVX2 static void CompressAvx2(__m256i state[8], const u8* const lanes[8], std::size_t blocks) {
+    const __m256i byte_swap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                              12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    for (std::size_t block = 0; block < blocks; ++block) {
+        __m256i w[64];
+        for (unsigned half = 0; half < 2; ++half) {
+            for (unsigned lane = 0; lane < 8; ++lane) {
+                w[half * 8 + lane] = _mm256_loadu_si256(
+                    (const __m256i*)(lanes[lane] + block * 64 + half * 32));
+            }
+            Transpose8(&w[half * 8]);
+        }
+        for (unsigned t = 0; t < 16; ++t) {
+            w[t] = _mm256_shuffle_epi8(w[t], byte_swap);
+        }
+        for (unsigned t = 16; t < 64; ++t) {
+            __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(Rotr(w[t - 15], 7), Rotr(w[t - 15], 18)),
+                                          _mm256_srli_epi32(w[t - 15], 3));
+            __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(Rotr(w[t - 2], 17), Rotr(w[t - 2], 19)),
+                                          _mm256_srli_epi32(w[t - 2], 10));
+            w[t] = _mm256_add_epi32(_mm256_add_epi32(w[t - 16], s0),
+                                    _mm256_add_epi32(w[t - 7], s1));
+        }
+
+        __m256i a = state[0], b = state[1], c = state[2], d = state[3];
+        __m256i e = state[4], f = state[5], g = state[6], h = state[7];
+        for (unsigned t = 0; t < 64; ++t) {
+            __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(Rotr(e, 6), Rotr(e, 11)), Rotr(e, 25));
+            __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+            __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, s1),
+                                          _mm256_add_epi32(ch, _mm256_add_epi32(
+                                                                   _mm256_set1_epi32((int)K[t]),
+                                                                   w[t])));
+            __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(Rotr(a, 2), Rotr(a, 13)), Rotr(a, 22));
+            __m256i maj = _mm256_xor_si256(
+                _mm256_xor_si256(_mm256_and_si256(a, b), _mm256_and_si256(a, c)),
+                _mm256_and_si256(b, c));
+            __m256i t2 = _mm256_add_epi32(s0, maj);
+            h = g;
+            g = f;
+            f = e;
+            e = _mm256_add_epi32(d, t1);
+            d = c;
+            c = b;
+            b = a;
+            a = _mm256_add_epi32(t1, t2);
+        }
+        state[0] = _mm256_add_epi32(state[0], a);
+        state[1] = _mm256_add_epi32(state[1], b);
+        state[2] = _mm256_add_epi32(state[2], c);
+        state[3] = _mm256_add_epi32(state[3], d);
+        state[4] = _mm256_add_epi32(state[4], e);
+        state[5] = _mm256_add_epi32(state[5], f);
+        state[6] = _mm256_add_epi32(state[6], g);
+        state[7] = _mm256_add_epi32(state[7], h);
+    }
+}
+
+// Hashes eight consecutive blocks of `block_size` bytes at once.
+AVX2 static void Sha256x8Avx2(const u8* data, std::size_t block_size, u8* out) {
+    __m256i state[8];
+    for (unsigned i = 0; i < 8; ++i) {
+        state[i] = _mm256_set1_epi32((int)InitialState[i]);
+    }
+
+    const u8* lanes[8];
+    for (unsigned lane = 0; lane < 8; ++lane) {
+        lanes[lane] = data + lane * block_size;
+    }
+    CompressAvx2(state, lanes, block_size / 64);
+
+    u8 tails[8][128];
+    std::size_t tail_blocks = 0;
+    for (unsigned lane = 0; lane < 8; ++lane) {
+        tail_blocks = MakeTail(lanes[lane] + block_size - block_size % 64, block_size, tails[lane]);
+        lanes[lane] = tails[lane];
+    }
+    CompressAvx2(state, lanes, tail_blocks);
+
+    const __m256i byte_swap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                              12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    Transpose8(state);
+    for (unsigned lane = 0; lane < 8; ++lane) {
+        _mm256_storeu_si256((__m256i*)(out + lane * 0x20),
+                            _mm256_shuffle_epi8(state[lane], byte_swap));
+    }
+}
+
+#undef AVX2
+
+static bool IsSupported(Sha256Backend backend) {
+    unsigned eax, ebx, ecx, edx;
+    switch (backend) {
+    case Sha256Backend::Scalar:
+        return true;
+    case Sha256Backend::ShaNi:
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1))
+            return false;
+        return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA);
+    case Sha256Backend::Avx2: {
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+            return false;
+        u32 xcr0_low, xcr0_high;
+        asm volatile("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+        if ((xcr0_low & 6) != 6)
+            return false;
+        return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_AVX2);
+    }
+    }
+    return false;
+}
+
+#else
+
+static bool IsSupported(Sha256Backend backend) {
+    return backend == Sha256Backend::Scalar;
+}
+
+#endif
+
+static Sha256Backend DetectBackend() {
+    if (IsSupported(Sha256Backend::ShaNi))
+        return Sha256Backend::ShaNi;
+    if (IsSupported(Sha256Backend::Avx2))
+        return Sha256Backend::Avx2;
+    return Sha256Backend::Scalar;
+}
+
+static std::atomic<Sha256Backend> current_backend{DetectBackend()};
+
+void Sha256(const u8* data, std::size_t size, u8* out) {
+#ifdef SHA256_X86
+    if (current_backend == Sha256Backend::ShaNi)
+        return Sha256ShaNi(data, size, out);
+#endif
+    Sha256Scalar(data, size, out);
+}
+
+void Sha256Blocks(const u8* data, std::size_t block_size, std::size_t count, u8* out) {
+#ifdef SHA256_X86
+    if (current_backend == Sha256Backend::Avx2) {
+        for (; count >= 8; count -= 8, data += block_size * 8, out += 0x20 * 8) {
+            Sha256x8Avx2(data, block_size, out);
+        }
+    }
+#endif
+    for (; count != 0; --count, data += block_size, out += 0x20) {
+        Sha256(data, block_size, out);
+    }
+}
+
+Sha256Backend GetSha256Backend() {
+    return current_backend;
+}
+
+bool SetSha256Backend(Sha256Backend backend) {
+    if (!IsSupported(backend))
+        return false;
+    current_backend = backend;
+    return true;
+}
+
+const char* GetSha256BackendName(Sha256Backend backend) {
+    switch (backend) {
+    case Sha256Backend::Scalar:
+        return "scalar";
+    case Sha256Backend::ShaNi:
+        return "sha-ni";
+    case Sha256Backend::Avx2:
+        return "avx2";
+    }
+    return "unknown";
+}
+}
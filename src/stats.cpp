@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include "file_interface.h"
+#include "io_trace.h"
+#include "stats.h"
+#include "trace.h"
+
+LayerStats::LayerStats(std::string label_) : label(std::move(label_)) {}
+
+void LayerStats::CountRead(std::size_t offset, std::size_t size,
+                           std::chrono::steady_clock::time_point start) {
+    auto duration = std::chrono::steady_clock::now() - start;
+    ++read_calls;
+    read_bytes += size;
+    wall_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    if (Trace::IsEnabled())
+        Trace::Span("layer", label + " read", start,
+                    Trace::Arg("offset", offset) + "," + Trace::Arg("size", size));
+    if (IoTrace::IsEnabled())
+        IoTrace::RecordLayer(label, false, offset, size, start);
+}
+
+void LayerStats::CountWrite(std::size_t offset, std::size_t size,
+                            std::chrono::steady_clock::time_point start) {
+    auto duration = std::chrono::steady_clock::now() - start;
+    ++write_calls;
+    write_bytes += size;
+    wall_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    if (Trace::IsEnabled())
+        Trace::Span("layer", label + " write", start,
+                    Trace::Arg("offset", offset) + "," + Trace::Arg("size", size));
+    if (IoTrace::IsEnabled())
+        IoTrace::RecordLayer(label, true, offset, size, start);
+}
+
+OpStats::OpStats(std::string name_) : name(std::move(name_)) {}
+
+void OpStats::Record(std::chrono::steady_clock::time_point start, u64 allocations_) {
+    u64 ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::steady_clock::now() - start)
+                 .count();
+    ++calls;
+    total_ns += ns;
+    allocations += allocations_;
+    u64 previous_max = max_ns;
+    while (ns > previous_max && !max_ns.compare_exchange_weak(previous_max, ns)) {
+    }
+
+    std::size_t bucket = 0;
+    for (u64 us = ns / 1000; us != 0 && bucket < BucketCount - 1; us >>= 1) {
+        ++bucket;
+    }
+    ++buckets[bucket];
+}
+
+u64 OpStats::Percentile(double fraction) const {
+    u64 total = calls;
+    u64 seen = 0;
+    for (std::size_t bucket = 0; bucket < BucketCount; ++bucket) {
+        seen += buckets[bucket];
+        if (seen != 0 && seen >= total * fraction)
+            return (u64)1 << bucket;
+    }
+    return 0;
+}
+
+OpStats& StatsRegistry::GetOp(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& op = ops[name];
+    if (!op)
+        op = std::make_unique<OpStats>(name);
+    return *op;
+}
+
+void StatsRegistry::Attach(FileInterface& layer, const std::string& label, bool physical) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = std::find_if(layers.begin(), layers.end(),
+                              [&](const auto& stats) { return stats->label == label; });
+    if (found != layers.end()) {
+        layer.SetStats(*found);
+        return;
+    }
+    auto stats = std::make_shared<LayerStats>(label);
+    stats->physical = physical;
+    layer.SetStats(stats);
+    layers.push_back(std::move(stats));
+}
+
+WriteWork StatsRegistry::GetWork() {
+    WriteWork work;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& layer : layers) {
+        if (layer->physical) {
+            work.physical_writes += layer->write_calls;
+            work.physical_bytes += layer->write_bytes;
+        }
+        work.blocks_hashed += layer->blocks_hashed;
+        work.cipher_blocks += layer->cipher_blocks;
+        work.signatures += layer->signatures;
+    }
+    return work;
+}
+
+void StatsRegistry::AccountWrite(const std::string& name, u64 logical_bytes,
+                                 const WriteWork& before) {
+    WriteWork after = GetWork();
+    WriteWork delta;
+    delta.logical_writes = logical_bytes != 0;
+    delta.logical_bytes = logical_bytes;
+    delta.physical_writes = after.physical_writes - before.physical_writes;
+    delta.physical_bytes = after.physical_bytes - before.physical_bytes;
+    delta.blocks_hashed = after.blocks_hashed - before.blocks_hashed;
+    delta.cipher_blocks = after.cipher_blocks - before.cipher_blocks;
+    delta.signatures = after.signatures - before.signatures;
+    if (delta.logical_bytes == 0 && delta.physical_writes == 0 && delta.blocks_hashed == 0 &&
+        delta.cipher_blocks == 0 && delta.signatures == 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (WriteWork* work : {&writes[name], &total_writes}) {
+        work->logical_writes += delta.logical_writes;
+        work->logical_bytes += delta.logical_bytes;
+        work->physical_writes += delta.physical_writes;
+        work->physical_bytes += delta.physical_bytes;
+        work->blocks_hashed += delta.blocks_hashed;
+        work->cipher_blocks += delta.cipher_blocks;
+        work->signatures += delta.signatures;
+    }
+}
+
+static std::string FormatWriteWork(const std::string& name, const WriteWork& work) {
+    // Ratios are per logical write, or per logical byte for the amplification.
+    auto ratio = [](u64 value, u64 base) { return base ? (double)value / base : 0.0; };
+    char line[256];
+    std::snprintf(line, sizeof(line),
+                  "%-32s %10" PRIu64 " %14" PRIu64 " %10" PRIu64 " %14" PRIu64
+                  " %10.2f %10.2f %10.2f %10.2f\n",
+                  name.c_str(), work.logical_writes, work.logical_bytes, work.physical_writes,
+                  work.physical_bytes, ratio(work.physical_bytes, work.logical_bytes),
+                  ratio(work.blocks_hashed, work.logical_writes),
+                  ratio(work.cipher_blocks, work.logical_writes),
+                  ratio(work.signatures, work.logical_writes));
+    return line;
+}
+
+std::string StatsRegistry::Dump() {
+    std::string result;
+    char line[256];
+    std::snprintf(line, sizeof(line),
+                  "%-20s %10s %14s %10s %14s %10s %10s %10s %10s %10s %10s %10s %12s\n", "layer",
+                  "reads", "read_bytes", "writes", "write_bytes", "hashed", "hash_fail", "cipher",
+                  "signed", "cache_hit", "cache_miss", "evicted", "wall_us");
+    result += line;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& layer : layers) {
+        std::snprintf(line, sizeof(line),
+                      "%-20s %10" PRIu64 " %14" PRIu64 " %10" PRIu64 " %14" PRIu64 " %10" PRIu64
+                      " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+                      " %10" PRIu64 " %12" PRIu64 "\n",
+                      layer->label.c_str(), (u64)layer->read_calls, (u64)layer->read_bytes,
+                      (u64)layer->write_calls, (u64)layer->write_bytes,
+                      (u64)layer->blocks_hashed, (u64)layer->hash_failures,
+                      (u64)layer->cipher_blocks, (u64)layer->signatures, (u64)layer->cache_hits,
+                      (u64)layer->cache_misses, (u64)layer->cache_evictions,
+                      (u64)layer->wall_ns / 1000);
+        result += line;
+    }
+
+    std::snprintf(line, sizeof(line), "\n%-20s %10s %12s %12s %12s %12s %10s  %s\n", "op",
+                  "calls", "avg_us", "p50_us", "p99_us", "max_us", "allocs/op",
+                  "histogram(<1us,<2us,<4us,...)");
+    result += line;
+    for (const auto& entry : ops) {
+        const OpStats& op = *entry.second;
+        u64 calls = op.calls;
+        std::snprintf(line, sizeof(line),
+                      "%-20s %10" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64
+                      " %10.1f ",
+                      op.name.c_str(), calls, calls ? (u64)op.total_ns / 1000 / calls : 0,
+                      op.Percentile(0.5), op.Percentile(0.99), (u64)op.max_ns / 1000,
+                      calls ? (double)op.allocations / calls : 0.0);
+        result += line;
+        std::size_t last_bucket = 0;
+        for (std::size_t bucket = 0; bucket < OpStats::BucketCount; ++bucket) {
+            if (op.buckets[bucket] != 0)
+                last_bucket = bucket;
+        }
+        for (std::size_t bucket = 0; bucket <= last_bucket; ++bucket) {
+            result += (bucket ? "," : " ") + std::to_string((u64)op.buckets[bucket]);
+        }
+        result += "\n";
+    }
+
+    std::snprintf(line, sizeof(line), "\n%-32s %10s %14s %10s %14s %10s %10s %10s %10s\n",
+                  "written", "writes", "bytes", "phys_wr", "phys_bytes", "amplif",
+                  "hash/wr", "cipher/wr", "sign/wr");
+    result += line;
+    for (const auto& entry : writes) {
+        result += FormatWriteWork(entry.first, entry.second);
+    }
+    result += FormatWriteWork("(total)", total_writes);
+    return result;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "common_types.h"
+
+class FileInterface;
+
+// Counters of one FileInterface layer instance. Calls, bytes and wall time are recorded by
+// FileInterface itself, so wall time includes the layers below. The remaining counters are
+// reported by the layers that do the hashing or ciphering.
+struct LayerStats {
+    LayerStats(std::string label_);
+
+    void CountRead(std::size_t offset, std::size_t size,
+                   std::chrono::steady_clock::time_point start);
+    void CountWrite(std::size_t offset, std::size_t size,
+                    std::chrono::steady_clock::time_point start);
+
+    const std::string label;
+    std::atomic<u64> read_calls{0};
+    std::atomic<u64> read_bytes{0};
+    std::atomic<u64> write_calls{0};
+    std::atomic<u64> write_bytes{0};
+    std::atomic<u64> blocks_hashed{0};
+    std::atomic<u64> hash_failures{0};
+    std::atomic<u64> cipher_blocks{0};
+    std::atomic<u64> signatures{0};
+    std::atomic<u64> cache_hits{0};
+    std::atomic<u64> cache_misses{0};
+    // Blocks of this layer evicted to make room for any layer sharing its budget.
+    std::atomic<u64> cache_evictions{0};
+    std::atomic<u64> wall_ns{0};
+    // Set for the layer writing to the host, whose writes are the physical ones.
+    bool physical = false;
+};
+
+// Work done by the whole stack on behalf of writes, used to report write amplification.
+struct WriteWork {
+    u64 logical_writes = 0;
+    u64 logical_bytes = 0;
+    u64 physical_writes = 0;
+    u64 physical_bytes = 0;
+    u64 blocks_hashed = 0;
+    u64 cipher_blocks = 0;
+    u64 signatures = 0;
+};
+
+// Latency histogram of one FUSE operation. Bucket i counts calls that took less than 2^i
+// microseconds (and at least 2^(i-1)).
+struct OpStats {
+    OpStats(std::string name_);
+
+    // `allocations` is the number of heap allocations made by the call.
+    void Record(std::chrono::steady_clock::time_point start, u64 allocations = 0);
+    // Upper bound, in microseconds, of the bucket holding the given fraction of calls.
+    u64 Percentile(double fraction) const;
+
+    static constexpr std::size_t BucketCount = 32;
+
+    const std::string name;
+    std::atomic<u64> calls{0};
+    std::atomic<u64> total_ns{0};
+    std::atomic<u64> max_ns{0};
+    std::atomic<u64> allocations{0};
+    std::array<std::atomic<u64>, BucketCount> buckets{};
+};
+
+class StatsRegistry {
+public:
+    // Returns the histogram of the FUSE operation `name`, creating it on first use.
+    OpStats& GetOp(const std::string& name);
+
+    // Starts counting for `layer`, labelled by its role in the stack, e.g. "save/ivfc_l4".
+    // `physical` marks the bottom layer whose writes reach the host file. A layer attached with
+    // the label of an earlier one, e.g. of a save opened again, adds to its counters.
+    void Attach(FileInterface& layer, const std::string& label, bool physical = false);
+
+    // Returns the physical writes and the hashing, ciphering and signing done so far by all layers.
+    WriteWork GetWork();
+
+    // Charges the work done since `before` to `name`, along with `logical_bytes` written by the
+    // user. Callers must keep other writers out in the meantime.
+    void AccountWrite(const std::string& name, u64 logical_bytes, const WriteWork& before);
+
+    // Renders a table of all counters, one layer per line, followed by the operation latencies
+    // and the write amplification of each file.
+    std::string Dump();
+
+private:
+    std::mutex mutex;
+    std::vector<std::shared_ptr<LayerStats>> layers;
+    std::map<std::string, std::unique_ptr<OpStats>> ops;
+    std::map<std::string, WriteWork> writes;
+    WriteWork total_writes;
+};
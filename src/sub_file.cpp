@@ -4,6 +4,12 @@
 SubFile::SubFile(std::shared_ptr<FileInterface> parent_, std::size_t offset_, std::size_t size_)
     : FileInterface(size_), parent(std::move(parent_)), offset(offset_) {
     assert(offset + file_size <= parent->file_size);
+    if (auto parent_window = dynamic_cast<SubFile*>(parent.get())) {
+        if (!parent_window->stats) {
+            offset += parent_window->offset;
+            parent = parent_window->parent;
+        }
+    }
 }
 
 bytes SubFile::ReadImpl(std::size_t offset, std::size_t size) {
@@ -13,3 +19,18 @@ bytes SubFile::ReadImpl(std::size_t offset, std::size_t size) {
 void SubFile::WriteImpl(std::size_t offset, const bytes& data) {
     return parent->Write(this->offset + offset, data);
 }
+
+void SubFile::ReadIntoImpl(std::size_t offset, std::size_t size, u8* dst) {
+    parent->Read(this->offset + offset, size, dst);
+}
+
+void SubFile::WriteFromImpl(std::size_t offset, std::size_t size, const u8* src) {
+    parent->Write(this->offset + offset, size, src);
+}
+
+std::shared_ptr<FileInterface> MakeSubFile(std::shared_ptr<FileInterface> parent,
+                                           std::size_t offset, std::size_t size) {
+    if (offset == 0 && size == parent->file_size)
+        return parent;
+    return std::make_shared<SubFile>(std::move(parent), offset, size);
+}
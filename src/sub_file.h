@@ -3,15 +3,24 @@
 #include <memory>
 #include "file_interface.h"
 
-class SubFile : public FileInterface {
+// A window of `size_` bytes at `offset_` into `parent_`. If `parent_` is itself a SubFile without
+// stats, the window is folded into it and accesses go straight to its parent.
+class SubFile final : public FileInterface {
 public:
     SubFile(std::shared_ptr<FileInterface> parent_, std::size_t offset_, std::size_t size_);
 
 protected:
     bytes ReadImpl(std::size_t offset, std::size_t size) override;
     void WriteImpl(std::size_t offset, const bytes& data) override;
+    void ReadIntoImpl(std::size_t offset, std::size_t size, u8* dst) override;
+    void WriteFromImpl(std::size_t offset, std::size_t size, const u8* src) override;
 
 private:
     std::shared_ptr<FileInterface> parent;
     std::size_t offset;
 };
+
+// Like SubFile, but returns `parent` itself if the window covers all of it. The result may be
+// shared with other layers, so stats must not be attached to it.
+std::shared_ptr<FileInterface> MakeSubFile(std::shared_ptr<FileInterface> parent,
+                                           std::size_t offset, std::size_t size);
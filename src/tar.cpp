@@ -0,0 +1,335 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "tar.h"
+
+static constexpr std::size_t RecordSize = 0x200;
+static constexpr std::size_t ChunkSize = 0x100000;
+
+// Type of a GNU header whose data is the name of the next entry.
+static constexpr char LongNameType = 'L';
+// Type of a pax header whose data holds "LENGTH KEY=VALUE\n" records for the next entry.
+static constexpr char PaxType = 'x';
+
+// Writes `value` as field_size - 1 octal digits and a NUL.
+static void PutOctal(char* field, std::size_t field_size, u64 value) {
+    field[field_size - 1] = 0;
+    for (std::size_t i = field_size - 1; i-- > 0; value >>= 3)
+        field[i] = (char)('0' + (value & 7));
+}
+
+static u64 GetOctal(const char* field, std::size_t field_size) {
+    u64 value = 0;
+    for (std::size_t i = 0; i < field_size && field[i]; ++i) {
+        if (field[i] >= '0' && field[i] <= '7')
+            value = value * 8 + (field[i] - '0');
+    }
+    return value;
+}
+
+static u32 Checksum(const u8* header) {
+    u32 sum = 0;
+    for (std::size_t i = 0; i < RecordSize; ++i)
+        sum += (i >= 148 && i < 156) ? ' ' : header[i];
+    return sum;
+}
+
+// Bytes that follow `size` bytes of entry data to fill the last record.
+static std::size_t Padding(u64 size) {
+    return (RecordSize - size % RecordSize) % RecordSize;
+}
+
+static bool WritePadding(std::FILE* out, u64 size) {
+    static const u8 zero[RecordSize]{};
+    return Padding(size) == 0 || std::fwrite(zero, Padding(size), 1, out) == 1;
+}
+
+static bool WriteHeader(std::FILE* out, const std::string& name, char type, u64 size) {
+    if (name.size() > 100) {
+        if (!WriteHeader(out, "././@LongLink", LongNameType, name.size() + 1) ||
+            std::fwrite(name.c_str(), name.size() + 1, 1, out) != 1 ||
+            !WritePadding(out, name.size() + 1))
+            return false;
+    }
+
+    u8 header[RecordSize]{};
+    char* h = (char*)header;
+    std::memcpy(h, name.data(), std::min<std::size_t>(name.size(), 100));
+    PutOctal(h + 100, 8, type == '5' ? 0755 : 0644);
+    PutOctal(h + 108, 8, 0);
+    PutOctal(h + 116, 8, 0);
+    PutOctal(h + 124, 12, size);
+    PutOctal(h + 136, 12, 0);
+    h[156] = type;
+    std::memcpy(h + 257, "ustar", 6);
+    std::memcpy(h + 263, "00", 2);
+    PutOctal(h + 148, 7, Checksum(header));
+    h[155] = ' ';
+    return std::fwrite(header, RecordSize, 1, out) == 1;
+}
+
+static bool ExportDir(FsInterface& fs, const std::string& path, u32 index, std::FILE* out) {
+    for (const FsName& name : fs.ListSubFile(index)) {
+        std::string sub_path = path + NameToString(name);
+        if (!IsHostSafeName(NameToString(name))) {
+            std::fprintf(stderr, "Skipping /%s\n", sub_path.c_str());
+            continue;
+        }
+        FsStat stat = fs.Find(("/" + sub_path).c_str());
+        FsFileInterface* file = stat.result == FsResult::FileExists ? fs.Open(stat.index) : nullptr;
+        if (!file) {
+            std::fprintf(stderr, "Failed to read /%s\n", sub_path.c_str());
+            continue;
+        }
+        u64 size = file->GetSize();
+        if (!WriteHeader(out, sub_path, '0', size)) {
+            file->Close();
+            return false;
+        }
+
+        bytes chunk(std::min<u64>(size, ChunkSize));
+        bool ok = true;
+        for (u64 offset = 0; ok && offset < size; offset += chunk.size()) {
+            std::size_t chunk_size = (std::size_t)std::min<u64>(size - offset, chunk.size());
+            ok = file->Read(offset, chunk_size, chunk.data()) == chunk_size &&
+                 std::fwrite(chunk.data(), chunk_size, 1, out) == 1;
+        }
+        file->Close();
+        if (!ok || !WritePadding(out, size))
+            return false;
+    }
+    for (const FsName& name : fs.ListSubDir(index)) {
+        std::string sub_path = path + NameToString(name) + "/";
+        if (!IsHostSafeName(NameToString(name))) {
+            std::fprintf(stderr, "Skipping /%s\n", sub_path.c_str());
+            continue;
+        }
+        FsStat stat = fs.Find(("/" + sub_path).c_str());
+        if (stat.result != FsResult::DirExists) {
+            std::fprintf(stderr, "Failed to read /%s\n", sub_path.c_str());
+            continue;
+        }
+        if (!WriteHeader(out, sub_path, '5', 0) || !ExportDir(fs, sub_path, stat.index, out))
+            return false;
+    }
+    return true;
+}
+
+bool ExportTar(FsInterface& fs, std::FILE* out) {
+    static const u8 end_of_archive[RecordSize * 2]{};
+    return ExportDir(fs, "", 1, out) &&
+           std::fwrite(end_of_archive, sizeof(end_of_archive), 1, out) == 1 &&
+           std::fflush(out) == 0;
+}
+
+static bool Skip(std::FILE* in, u64 size) {
+    u8 buffer[RecordSize];
+    while (size != 0) {
+        std::size_t chunk_size = (std::size_t)std::min<u64>(size, RecordSize);
+        if (std::fread(buffer, chunk_size, 1, in) != 1)
+            return false;
+        size -= chunk_size;
+    }
+    return true;
+}
+
+// Returns the value of the "path" record of pax header data, or an empty string.
+static std::string GetPaxPath(const std::string& data) {
+    std::size_t begin = 0;
+    while (begin < data.size()) {
+        std::size_t length = std::strtoul(data.c_str() + begin, nullptr, 10);
+        std::size_t key = data.find(' ', begin);
+        if (length == 0 || key == std::string::npos || begin + length > data.size())
+            break;
+        std::string record = data.substr(key + 1, begin + length - key - 2);
+        if (record.compare(0, 5, "path=") == 0)
+            return record.substr(5);
+        begin += length;
+    }
+    return {};
+}
+
+// Splits `path` into its components, dropping empty and "." ones.
+static std::vector<std::string> SplitPath(const std::string& path) {
+    std::vector<std::string> components;
+    std::size_t begin = 0;
+    while (begin <= path.size()) {
+        std::size_t end = path.find('/', begin);
+        if (end == std::string::npos)
+            end = path.size();
+        std::string component = path.substr(begin, end - begin);
+        if (!component.empty() && component != ".")
+            components.push_back(component);
+        begin = end + 1;
+    }
+    return components;
+}
+
+static bool ToFsName(const std::string& component, FsName& name) {
+    if (component.size() > name.size() || component == "..")
+        return false;
+    name = FsName{};
+    std::memcpy(name.data(), component.data(), component.size());
+    return true;
+}
+
+// Returns the index of the directory made of the first `count` components, creating missing
+// ones, or 0 on failure.
+static u32 MakeDirs(Disa& disa, const std::vector<std::string>& components, std::size_t count) {
+    u32 index = 1;
+    std::string path;
+    for (std::size_t i = 0; i < count; ++i) {
+        path += "/" + components[i];
+        FsName name;
+        if (!ToFsName(components[i], name))
+            return 0;
+        FsStat stat = disa.Find(path.c_str());
+        if (stat.result == FsResult::DirExists)
+            index = stat.index;
+        else if (stat.result == FsResult::NotFound)
+            index = disa.MakeDir(name, index);
+        else
+            return 0;
+        if (index == 0)
+            return 0;
+    }
+    return index;
+}
+
+// Counts into `missing` the directories that MakeDirs would create for the first `count`
+// components. Returns false if MakeDirs would fail.
+static bool CountMissingDirs(Disa& disa, const std::vector<std::string>& components,
+                             std::size_t count, u32& missing) {
+    missing = 0;
+    std::string path;
+    for (std::size_t i = 0; i < count; ++i) {
+        path += "/" + components[i];
+        FsName name;
+        if (!ToFsName(components[i], name))
+            return false;
+        if (missing != 0) {
+            ++missing;
+            continue;
+        }
+        FsResult result = disa.Find(path.c_str()).result;
+        if (result == FsResult::NotFound)
+            ++missing;
+        else if (result != FsResult::DirExists)
+            return false;
+    }
+    return true;
+}
+
+// `free_blocks` tracks the free blocks of `disa` across members, since allocating past them would
+// assert in the FAT. Nothing is changed for a member that does not fit.
+static bool ImportFile(Disa& disa, const std::vector<std::string>& components, u64 size,
+                       std::FILE* in, u64& free_blocks) {
+    FsName name;
+    std::string path;
+    for (const std::string& component : components)
+        path += "/" + component;
+    FsStat stat = disa.Find(path.c_str());
+    u32 missing_dirs;
+    if (!CountMissingDirs(disa, components, components.size() - 1, missing_dirs) ||
+        !ToFsName(components.back(), name) || stat.result == FsResult::DirExists) {
+        std::fprintf(stderr, "Cannot import %s\n", path.c_str());
+        Skip(in, size + Padding(size));
+        return false;
+    }
+    bool exists = stat.result == FsResult::FileExists;
+    u64 available_blocks = free_blocks;
+    if (exists)
+        available_blocks += disa.CountBlocks(disa.GetFileSize(stat.index));
+    if (disa.CountBlocks(size) > available_blocks || missing_dirs > disa.GetFreeDirCount() ||
+        (!exists && disa.GetFreeFileCount() == 0)) {
+        std::fprintf(stderr, "No room for %s\n", path.c_str());
+        Skip(in, size + Padding(size));
+        return false;
+    }
+    u32 parent = MakeDirs(disa, components, components.size() - 1);
+    if (exists)
+        disa.RemoveFile(stat.index);
+    u32 index = parent == 0 ? 0 : disa.MakeFile(name, parent);
+    if (index == 0) {
+        std::fprintf(stderr, "No room for %s\n", path.c_str());
+        Skip(in, size + Padding(size));
+        return false;
+    }
+    free_blocks = available_blocks - disa.CountBlocks(size);
+
+    FsFileInterface* file = disa.Open(index);
+    bytes chunk(std::min<u64>(size, ChunkSize));
+    bool ok = true;
+    for (u64 offset = 0; ok && offset < size; offset += chunk.size()) {
+        std::size_t chunk_size = (std::size_t)std::min<u64>(size - offset, chunk.size());
+        ok = std::fread(chunk.data(), chunk_size, 1, in) == 1;
+        if (ok)
+            file->Write(offset, chunk_size, chunk.data());
+    }
+    file->Close();
+    return ok && Skip(in, Padding(size));
+}
+
+bool ImportTar(Disa& disa, std::FILE* in) {
+    disa.BeginBatch();
+    u64 free_blocks = disa.GetFreeBlockCount();
+    bool ok = true;
+    std::string long_name;
+    u8 header[RecordSize];
+    while (true) {
+        if (std::fread(header, RecordSize, 1, in) != 1) {
+            std::fprintf(stderr, "Unexpected end of archive\n");
+            ok = false;
+            break;
+        }
+        const char* h = (const char*)header;
+        if (h[0] == 0)
+            break;
+        if (GetOctal(h + 148, 8) != Checksum(header)) {
+            std::fprintf(stderr, "Bad tar header checksum\n");
+            ok = false;
+            break;
+        }
+
+        char type = h[156];
+        u64 size = GetOctal(h + 124, 12);
+        std::string name;
+        if (!long_name.empty()) {
+            name = std::move(long_name);
+            long_name.clear();
+        } else {
+            if (std::memcmp(h + 257, "ustar", 6) == 0 && h[345])
+                name = std::string(h + 345, strnlen(h + 345, 155)) + "/";
+            name += std::string(h, strnlen(h, 100));
+        }
+
+        std::vector<std::string> components = SplitPath(name);
+        if (type == LongNameType || type == PaxType) {
+            std::string data(size, '\0');
+            if ((size && std::fread(&data[0], size, 1, in) != 1) || !Skip(in, Padding(size))) {
+                ok = false;
+                break;
+            }
+            long_name = type == PaxType ? GetPaxPath(data)
+                                        : data.substr(0, strnlen(data.c_str(), size));
+        } else if (type == '5') {
+            if (!components.empty() && MakeDirs(disa, components, components.size()) == 0) {
+                std::fprintf(stderr, "Cannot import %s\n", name.c_str());
+                ok = false;
+            }
+        } else if ((type == '0' || type == 0) && !components.empty()) {
+            ok = ImportFile(disa, components, size, in, free_blocks) && ok;
+        } else {
+            if (type != 'g')
+                std::fprintf(stderr, "Skipping %s\n", name.c_str());
+            if (!Skip(in, size + Padding(size))) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    disa.CommitBatch();
+    return ok;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdio>
+#include "disa.h"
+#include "fs_interface.h"
+
+// Writes every directory and file of `fs` to `out` as a ustar archive, streaming file data
+// without intermediate files. Entries whose names are not safe as a path component, such as
+// "..", are skipped. Returns false on a write error.
+bool ExportTar(FsInterface& fs, std::FILE* out);
+
+// Reads a tar archive from `in` and writes its directories and regular files into `disa`,
+// replacing existing files, in a single batch. Other entry types are skipped. Returns false if
+// the archive is malformed or an entry could not be imported.
+bool ImportTar(Disa& disa, std::FILE* in);
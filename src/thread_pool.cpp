@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <pthread.h>
+#include "thread_pool.h"
+
+static thread_local bool in_pool_job = false;
+
+// Never destroyed, since a forked child cannot join the workers it inherited the handles of.
+static ThreadPool* default_pool = nullptr;
+static std::mutex default_pool_mutex;
+
+static void LockDefaultPool() {
+    default_pool_mutex.lock();
+}
+
+static void UnlockDefaultPool() {
+    default_pool_mutex.unlock();
+}
+
+// fork() only copies the calling thread, so the workers of the default pool do not exist in the
+// child, e.g. in a FUSE daemon, and a job would wait for them forever. The child leaves that pool
+// alone and starts its own on first use.
+static void ForgetDefaultPool() {
+    default_pool = nullptr;
+    default_pool_mutex.unlock();
+}
+
+ThreadPool::ThreadPool(unsigned worker_count) {
+    for (unsigned i = 0; i < worker_count; ++i) {
+        workers.emplace_back([this] { WorkerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    start_cv.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::ParallelFor(std::size_t count, const std::function<void(std::size_t)>& func) {
+    if (workers.empty() || count < 2 || in_pool_job) {
+        for (std::size_t i = 0; i < count; ++i) {
+            func(i);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> job_guard(job_lock);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &func;
+        job_count = count;
+        next_index = 0;
+        busy_workers = workers.size();
+        ++generation;
+    }
+    start_cv.notify_all();
+
+    RunJob();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [this] { return busy_workers == 0; });
+    job = nullptr;
+}
+
+unsigned ThreadPool::GetThreadCount() const {
+    return (unsigned)workers.size() + 1;
+}
+
+ThreadPool& ThreadPool::Default() {
+    static bool fork_handler_registered = false;
+    std::lock_guard<std::mutex> lock(default_pool_mutex);
+    if (!default_pool) {
+        if (!fork_handler_registered) {
+            pthread_atfork(LockDefaultPool, UnlockDefaultPool, ForgetDefaultPool);
+            fork_handler_registered = true;
+        }
+        default_pool = new ThreadPool(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+    }
+    return *default_pool;
+}
+
+void ThreadPool::WorkerLoop() {
+    u64 seen_generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            start_cv.wait(lock, [&] { return stop || generation != seen_generation; });
+            if (stop)
+                return;
+            seen_generation = generation;
+        }
+
+        RunJob();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busy_workers == 0)
+            done_cv.notify_one();
+    }
+}
+
+void ThreadPool::RunJob() {
+    in_pool_job = true;
+    while (true) {
+        std::size_t i = next_index++;
+        if (i >= job_count)
+            break;
+        (*job)(i);
+    }
+    in_pool_job = false;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "common_types.h"
+
+class ThreadPool {
+public:
+    ThreadPool(unsigned worker_count);
+    ~ThreadPool();
+
+    // Calls func(i) for every i in [0, count) on the worker threads and the calling thread, and
+    // returns once all calls have finished. Calls made from inside func run serially.
+    void ParallelFor(std::size_t count, const std::function<void(std::size_t)>& func);
+
+    unsigned GetThreadCount() const;
+
+    // One worker per CPU beyond the calling thread, started on first use, and again on first use
+    // in a forked child.
+    static ThreadPool& Default();
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex job_lock;
+
+    std::mutex mutex;
+    std::condition_variable start_cv, done_cv;
+    bool stop = false;
+    u64 generation = 0;
+    std::size_t busy_workers = 0;
+
+    const std::function<void(std::size_t)>* job = nullptr;
+    std::size_t job_count = 0;
+    std::atomic<std::size_t> next_index{0};
+
+    void WorkerLoop();
+    void RunJob();
+};
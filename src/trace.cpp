@@ -0,0 +1,80 @@
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <mutex>
+#include <unistd.h>
+#include "trace.h"
+
+namespace Trace {
+
+static std::atomic<bool> enabled{false};
+static std::mutex mutex;
+static std::FILE* handle = nullptr;
+static std::chrono::steady_clock::time_point epoch;
+static std::atomic<u32> next_thread_id{1};
+
+static std::string Escape(const std::string& text) {
+    std::string result;
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            result += '\\';
+        if ((unsigned char)c < 0x20)
+            continue;
+        result += c;
+    }
+    return result;
+}
+
+bool Open(const char* path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    handle = std::fopen(path, "w");
+    if (!handle)
+        return false;
+    epoch = std::chrono::steady_clock::now();
+    std::fputs("[\n", handle);
+    enabled = true;
+    return true;
+}
+
+void Close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!handle)
+        return;
+    enabled = false;
+    // Every event ends with a comma; the empty event keeps the file valid JSON.
+    std::fputs("{}]\n", handle);
+    std::fclose(handle);
+    handle = nullptr;
+}
+
+bool IsEnabled() {
+    return enabled;
+}
+
+std::string Arg(const char* key, const std::string& value) {
+    return "\"" + std::string(key) + "\":\"" + Escape(value) + "\"";
+}
+
+std::string Arg(const char* key, u64 value) {
+    return "\"" + std::string(key) + "\":" + std::to_string(value);
+}
+
+void Span(const char* category, const std::string& name,
+          std::chrono::steady_clock::time_point start, const std::string& args) {
+    if (!enabled)
+        return;
+    auto end = std::chrono::steady_clock::now();
+    static thread_local u32 thread_id = next_thread_id++;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!handle)
+        return;
+    auto since_epoch = std::chrono::duration<double, std::micro>(start - epoch).count();
+    auto duration = std::chrono::duration<double, std::micro>(end - start).count();
+    std::fprintf(handle,
+                 "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                 "\"pid\":%d,\"tid\":%" PRIu32 ",\"args\":{%s}},\n",
+                 Escape(name).c_str(), category, since_epoch, duration, (int)getpid(), thread_id,
+                 args.c_str());
+}
+}
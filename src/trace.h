@@ -0,0 +1,22 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include "common_types.h"
+
+// Optional event log in the Chrome trace format (load it in chrome://tracing or Perfetto). Each
+// FUSE operation and each call into an instrumented layer becomes a complete event; layer calls
+// nest under the operation that caused them on the same thread.
+namespace Trace {
+
+bool Open(const char* path);
+void Close();
+bool IsEnabled();
+
+// Formats one entry of the `args` object of an event; join several with commas.
+std::string Arg(const char* key, const std::string& value);
+std::string Arg(const char* key, u64 value);
+
+void Span(const char* category, const std::string& name,
+          std::chrono::steady_clock::time_point start, const std::string& args = "");
+}
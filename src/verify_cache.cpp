@@ -0,0 +1,115 @@
+#include <cstdio>
+#include <sys/stat.h>
+#include "crypto.h"
+#include "verify_cache.h"
+
+static const u8 SidecarMagic[8] = {'3', 'D', 'S', 'V', 'C', 'A', 'C', 'H'};
+
+VerifyCache::VerifyCache(std::string sidecar_path_, std::string image_path_,
+                         std::shared_ptr<FileInterface> container_)
+    : sidecar_path(std::move(sidecar_path_)), image_path(std::move(image_path_)),
+      container(std::move(container_)) {
+    std::FILE* handle = std::fopen(sidecar_path.c_str(), "rb");
+    if (!handle)
+        return;
+
+    bytes sidecar;
+    u8 buffer[0x1000];
+    std::size_t read_size;
+    while ((read_size = std::fread(buffer, 1, sizeof(buffer), handle)) != 0) {
+        sidecar.insert(sidecar.end(), buffer, buffer + read_size);
+    }
+    std::fclose(handle);
+
+    // A truncated or stale sidecar is silently ignored.
+    std::size_t pos = 0;
+    bool truncated = false;
+    auto take = [&](std::size_t size) {
+        if (truncated || sidecar.size() - pos < size) {
+            // Keep fixed-size fields decodable; the content is discarded anyway.
+            truncated = true;
+            return bytes(std::min<std::size_t>(size, 8));
+        }
+        bytes field(sidecar.begin() + pos, sidecar.begin() + pos + size);
+        pos += size;
+        return field;
+    };
+
+    if (take(8) != bytes(SidecarMagic, SidecarMagic + 8) || take(0x20) != ComputeKey() ||
+        truncated)
+        return;
+    bool loaded_header_verified = Decode<u8>(take(1)) != 0;
+    std::map<std::string, std::shared_ptr<std::vector<bool>>> loaded_levels;
+    u32 level_count = Decode<u32>(take(4));
+    for (u32 i = 0; i < level_count && !truncated; ++i) {
+        auto label = take(Decode<u32>(take(4)));
+        u64 block_count = Decode<u64>(take(8));
+        auto bitmap = take((block_count + 7) / 8);
+        if (truncated)
+            break;
+        auto level = std::make_shared<std::vector<bool>>(block_count);
+        for (u64 block = 0; block < block_count; ++block) {
+            (*level)[block] = (bitmap[block / 8] >> (block % 8)) & 1;
+        }
+        loaded_levels[std::string(label.begin(), label.end())] = std::move(level);
+    }
+    if (truncated)
+        return;
+    header_verified = loaded_header_verified;
+    levels = std::move(loaded_levels);
+}
+
+std::shared_ptr<std::vector<bool>> VerifyCache::GetLevel(const std::string& label,
+                                                         std::size_t block_count) {
+    auto& level = levels[label];
+    if (!level || level->size() != block_count)
+        level = std::make_shared<std::vector<bool>>(block_count);
+    return level;
+}
+
+bool VerifyCache::IsHeaderVerified() const {
+    return header_verified;
+}
+
+void VerifyCache::SetHeaderVerified() {
+    header_verified = true;
+}
+
+void VerifyCache::Save() {
+    bytes sidecar(SidecarMagic, SidecarMagic + 8);
+    sidecar += ComputeKey();
+    sidecar += Encode<u8>(header_verified);
+    sidecar += Encode<u32>((u32)levels.size());
+    for (const auto& level : levels) {
+        sidecar += Encode<u32>((u32)level.first.size());
+        sidecar.insert(sidecar.end(), level.first.begin(), level.first.end());
+        sidecar += Encode<u64>(level.second->size());
+        bytes bitmap((level.second->size() + 7) / 8);
+        for (std::size_t block = 0; block < level.second->size(); ++block) {
+            if ((*level.second)[block])
+                bitmap[block / 8] |= 1 << (block % 8);
+        }
+        sidecar += bitmap;
+    }
+
+    std::FILE* handle = std::fopen(sidecar_path.c_str(), "wb");
+    if (!handle) {
+        std::fprintf(stderr, "Failed to write verification cache %s\n", sidecar_path.c_str());
+        return;
+    }
+    std::fwrite(sidecar.data(), sidecar.size(), 1, handle);
+    std::fclose(handle);
+}
+
+bytes VerifyCache::ComputeKey() {
+    struct stat image_stat;
+    if (::stat(image_path.c_str(), &image_stat) != 0)
+        return bytes(0x20, 0);
+
+    bytes key(image_path.begin(), image_path.end());
+    key += Encode<u64>(image_stat.st_size);
+    key += Encode<u64>(image_stat.st_mtim.tv_sec);
+    key += Encode<u64>(image_stat.st_mtim.tv_nsec);
+    key += container->Read(0, 0x200);
+    return Crypto::Sha256(key);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "file_interface.h"
+
+// Remembers which IVFC blocks and whether the CMAC header have been verified, and persists that
+// in a sidecar file so that remounting an unchanged image skips re-hashing. The sidecar is keyed
+// by the image path, size, modification time and the DISA header, which holds the root of the
+// IVFC master hash chain; any mismatch discards it.
+class VerifyCache {
+public:
+    VerifyCache(std::string sidecar_path_, std::string image_path_,
+                std::shared_ptr<FileInterface> container_);
+
+    // Returns the verified-block map of the IVFC level labelled `label`.
+    std::shared_ptr<std::vector<bool>> GetLevel(const std::string& label, std::size_t block_count);
+
+    bool IsHeaderVerified() const;
+    void SetHeaderVerified();
+
+    // Writes the sidecar for the current state of the image. Call after all writes have landed.
+    void Save();
+
+private:
+    std::string sidecar_path;
+    std::string image_path;
+    std::shared_ptr<FileInterface> container;
+    bool header_verified = false;
+    std::map<std::string, std::shared_ptr<std::vector<bool>>> levels;
+
+    bytes ComputeKey();
+};